@@ -0,0 +1,347 @@
+#include "bookexporter.h"
+#include "bookpaths.h"
+#include "notesdialog.h"
+#include "logging.h"
+#include "stepsource.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QFuture>
+#include <QImageReader>
+#include <QPainter>
+#include <QPdfWriter>
+#include <QTextDocument>
+#include <QThread>
+#include <QPageSize>
+#include <QtConcurrent/QtConcurrentRun>
+#include <QtMath>
+
+#include <memory>
+
+namespace {
+
+// Лист A4 при 150 dpi
+const int PageDpi = 150;
+const QSize PageSize(1240, 1754);
+const int PageMargin = 60;
+const int FooterHeight = 40;
+const int CellSpacing = 20;
+
+// Сколько страниц готовится одновременно - не зависит от числа ядер,
+// чтобы память экспорта была ограничена (растровая страница A4 - ~9 МБ)
+const int MaxPagesInFlight = 4;
+
+QFont captionFont()
+{
+    QFont font;
+    font.setPixelSize(18);
+    font.setBold(true);
+    return font;
+}
+
+}
+
+BookExporter::BookExporter(const QStringList &imagePaths)
+    : m_imagePaths(imagePaths)
+    , m_stepsPerPage(0)
+    , m_columns(1)
+    , m_rows(1)
+{
+    setStepsPerPage(4);
+}
+
+void BookExporter::setStepsPerPage(int steps)
+{
+    m_stepsPerPage = qMax(1, steps);
+
+    // Сетка как можно ближе к квадратной: 4 -> 2x2, 6 -> 3x2
+    m_columns = qCeil(qSqrt(m_stepsPerPage));
+    m_rows = (m_stepsPerPage + m_columns - 1) / m_columns;
+}
+
+int BookExporter::pageCount() const
+{
+    return (m_imagePaths.size() + m_stepsPerPage - 1) / m_stepsPerPage;
+}
+
+BookExporter::Format BookExporter::formatForFile(const QString &filePath)
+{
+    return QFileInfo(filePath).suffix().compare("png", Qt::CaseInsensitive) == 0 ? Png : Pdf;
+}
+
+QString BookExporter::pngPagePath(const QString &filePath, int page)
+{
+    QFileInfo info(filePath);
+    return info.path() + "/" + info.completeBaseName()
+           + QString("_%1.png").arg(page + 1, 4, 10, QChar('0'));
+}
+
+bool BookExporter::exportTo(const QString &filePath, Format format, const ProgressCallback &progress)
+{
+    m_errorString.clear();
+
+    const int total = pageCount();
+    if (total == 0) {
+        m_errorString = "Нет шагов для экспорта";
+        return false;
+    }
+
+    std::unique_ptr<QPdfWriter> pdfWriter;
+    QPainter pdfPainter;
+    if (format == Pdf) {
+        pdfWriter.reset(new QPdfWriter(filePath));
+        pdfWriter->setPageSize(QPageSize(QPageSize::A4));
+        pdfWriter->setPageMargins(QMarginsF(0, 0, 0, 0));
+        pdfWriter->setResolution(PageDpi);
+        pdfWriter->setTitle("Инструкция по сборке");
+
+        if (!pdfPainter.begin(pdfWriter.get())) {
+            m_errorString = "Не удалось создать файл: " + filePath;
+            return false;
+        }
+    }
+
+    // PNG лист рисуется и сохраняется целиком в рабочем потоке. Для PDF в потоке
+    // читаются изображения, подписи и замечания и верстаются подписи, а рисуется
+    // страница прямо в PDF в этом потоке - так текст остается текстом, по которому
+    // работает поиск
+    struct PageResult {
+        QVector<StepContent> steps; // Только для PDF
+        bool ok = false;
+    };
+
+    QThread *exportThread = QThread::currentThread();
+    auto startPage = [this, format, filePath, exportThread](int page) {
+        return QtConcurrent::run([this, page, format, filePath, exportThread]() {
+            PageResult result;
+            if (format == Png) {
+                QImage image(PageSize, QImage::Format_RGB32);
+                image.fill(Qt::white);
+                QPainter painter(&image);
+                paintPage(painter, page, loadPageContent(page, nullptr));
+                painter.end();
+                result.ok = image.save(pngPagePath(filePath, page), "PNG");
+            } else {
+                result.steps = loadPageContent(page, exportThread);
+                result.ok = true;
+            }
+            return result;
+        });
+    };
+
+    bool ok = true;
+    bool cancelled = false;
+    int done = 0;
+    int next = 0;
+
+    QList<QFuture<PageResult>> inFlight;
+    while (inFlight.size() < MaxPagesInFlight && next < total) {
+        inFlight << startPage(next++);
+    }
+
+    // Результаты забираем по порядку страниц, на место забранной запускаем следующую.
+    // После ошибки или отмены только дожидаемся уже запущенных задач
+    while (!inFlight.isEmpty()) {
+        PageResult result = inFlight.takeFirst().result();
+        if (ok && next < total) {
+            inFlight << startPage(next++);
+        }
+        if (!ok) continue;
+
+        if (!result.ok) {
+            ok = false;
+            m_errorString = "Не удалось сохранить страницу: " + pngPagePath(filePath, done);
+            continue;
+        }
+
+        if (format == Pdf) {
+            if (done > 0) {
+                pdfWriter->newPage();
+            }
+            paintPage(pdfPainter, done, result.steps);
+        }
+
+        ++done;
+        if (progress && !progress(done, total)) {
+            ok = false;
+            cancelled = true;
+        }
+    }
+
+    if (format == Pdf) {
+        pdfPainter.end();
+        if (!ok) {
+            QFile::remove(filePath);
+        }
+    }
+
+    if (cancelled) {
+        qCDebug(lcExport) << "Export cancelled after" << done << "of" << total << "pages";
+    }
+    return ok;
+}
+
+QRect BookExporter::stepCell(int slot) const
+{
+    QRect content = QRect(QPoint(0, 0), PageSize).adjusted(PageMargin, PageMargin, -PageMargin, -PageMargin);
+    QRect grid = content.adjusted(0, 0, 0, -FooterHeight);
+
+    int cellWidth = grid.width() / m_columns;
+    int cellHeight = grid.height() / m_rows;
+
+    QRect cell(grid.x() + (slot % m_columns) * cellWidth,
+               grid.y() + (slot / m_columns) * cellHeight,
+               cellWidth, cellHeight);
+    return cell.adjusted(CellSpacing / 2, CellSpacing / 2, -CellSpacing / 2, -CellSpacing / 2);
+}
+
+QRect BookExporter::innerRect(const QRect &cell)
+{
+    return cell.adjusted(12, 8, -12, -8);
+}
+
+QRect BookExporter::imageBox(const QRect &cell)
+{
+    // Изображение занимает большую часть ячейки, под заголовком шага
+    QRect inner = innerRect(cell);
+    return QRect(inner.x(), inner.y() + 37, inner.width(), inner.height() * 60 / 100);
+}
+
+QVector<BookExporter::StepContent> BookExporter::loadPageContent(int page, QThread *documentThread) const
+{
+    QVector<StepContent> steps;
+    for (int slot = 0; slot < m_stepsPerPage; ++slot) {
+        int step = page * m_stepsPerPage + slot;
+        if (step >= m_imagePaths.size()) break;
+
+        const QString imagePath = m_imagePaths[step];
+        const QRect cell = stepCell(slot);
+
+        StepContent content;
+        content.image = loadScaledImage(imagePath, imageBox(cell).size());
+
+        // Подпись шага - та же, что показывается под изображением в окне
+        CaptionView::Format format = CaptionView::PlainText;
+        QString caption = BookPaths::loadCaption(imagePath, &format);
+        if (caption.isEmpty()) {
+            caption = QFileInfo(imagePath).fileName();
+            format = CaptionView::PlainText;
+        }
+
+        // Разбор и верстка - здесь же; документ рисует поток, в котором идет экспорт
+        content.caption.reset(CaptionView::createDocument(caption, format));
+        content.caption->setDefaultFont(captionFont());
+        content.caption->setTextWidth(innerRect(cell).width());
+        if (documentThread) {
+            content.caption->moveToThread(documentThread);
+        }
+
+        content.notes = NotesDialog::readNotes(step);
+        steps << content;
+    }
+    return steps;
+}
+
+void BookExporter::paintPage(QPainter &painter, int page, const QVector<StepContent> &steps) const
+{
+    painter.setRenderHint(QPainter::Antialiasing);
+    painter.setRenderHint(QPainter::SmoothPixmapTransform);
+
+    for (int slot = 0; slot < steps.size(); ++slot) {
+        drawStep(painter, stepCell(slot), page * m_stepsPerPage + slot, steps[slot]);
+    }
+
+    // Номер страницы
+    QRect content = QRect(QPoint(0, 0), PageSize).adjusted(PageMargin, PageMargin, -PageMargin, -PageMargin);
+    QFont footerFont = painter.font();
+    footerFont.setPixelSize(18);
+    footerFont.setBold(false);
+    painter.setFont(footerFont);
+    painter.setPen(QColor("#666666"));
+    painter.drawText(QRect(content.x(), content.bottom() - FooterHeight, content.width(), FooterHeight),
+                     Qt::AlignRight | Qt::AlignBottom,
+                     QString("Страница %1 из %2").arg(page + 1).arg(pageCount()));
+}
+
+void BookExporter::drawStep(QPainter &painter, const QRect &cell, int step, const StepContent &content) const
+{
+    const QString imagePath = m_imagePaths[step];
+
+    painter.setPen(QPen(QColor("#cccccc"), 2));
+    painter.setBrush(Qt::NoBrush);
+    painter.drawRect(cell);
+
+    QRect inner = innerRect(cell);
+
+    // Заголовок шага
+    QFont titleFont = painter.font();
+    titleFont.setPixelSize(22);
+    titleFont.setBold(true);
+    painter.setFont(titleFont);
+    painter.setPen(Qt::black);
+    QRect titleRect(inner.x(), inner.y(), inner.width(), 32);
+    painter.drawText(titleRect, Qt::AlignLeft | Qt::AlignVCenter,
+                     QString("Шаг %1/%2").arg(step + 1).arg(m_imagePaths.size()));
+
+    // Растром рисуется только само изображение шага
+    QRect imageArea = imageBox(cell);
+    const QImage &stepImage = content.image;
+    if (!stepImage.isNull()) {
+        QRect target(QPoint(0, 0), stepImage.size().scaled(imageArea.size(), Qt::KeepAspectRatio));
+        target.moveCenter(imageArea.center());
+        painter.drawImage(target, stepImage);
+    } else {
+        painter.setPen(QColor("#999999"));
+        painter.drawText(imageArea, Qt::AlignCenter | Qt::TextWordWrap,
+                         "Не удалось загрузить изображение:\n" + QFileInfo(imagePath).fileName());
+    }
+
+    // Подпись уже сверстана под ширину ячейки
+    QRect textArea(inner.x(), imageArea.bottom() + 8, inner.width(), inner.bottom() - imageArea.bottom() - 8);
+    QTextDocument *captionDocument = content.caption.get();
+
+    int captionHeight = qMin(qCeil(captionDocument->size().height()), textArea.height());
+    QRect captionRect(textArea.x(), textArea.y(), textArea.width(), captionHeight);
+
+    painter.save();
+    painter.translate(captionRect.topLeft());
+    captionDocument->drawContents(&painter, QRectF(0, 0, captionRect.width(), captionRect.height()));
+    painter.restore();
+
+    // Замечания шага
+    const QStringList &notes = content.notes;
+    if (notes.isEmpty()) return;
+
+    QRect notesRect(textArea.x(), captionRect.bottom() + 6, textArea.width(), textArea.bottom() - captionRect.bottom() - 6);
+    if (notesRect.height() <= 0) return;
+
+    QFont notesFont = painter.font();
+    notesFont.setPixelSize(15);
+    notesFont.setBold(false);
+    painter.setFont(notesFont);
+    painter.setPen(QColor("#E65100"));
+
+    painter.save();
+    painter.setClipRect(notesRect);
+    painter.drawText(notesRect, Qt::AlignLeft | Qt::AlignTop | Qt::TextWordWrap,
+                     "Замечания:\n" + notes.join("\n"));
+    painter.restore();
+}
+
+QImage BookExporter::loadScaledImage(const QString &path, const QSize &box)
+{
+    // Просим декодер сразу выдать уменьшенное изображение: JPEG в этом
+    // случае декодируется с понижением разрешения и в разы быстрее
+    std::unique_ptr<QIODevice> device = StepSource::openFile(path);
+    QImageReader reader(device.get(), QFileInfo(path).suffix().toLatin1());
+    QSize size = reader.size();
+    if (size.isValid() && (size.width() > box.width() || size.height() > box.height())) {
+        reader.setScaledSize(size.scaled(box, Qt::KeepAspectRatio));
+    }
+
+    QImage image = reader.read();
+    if (image.isNull()) {
+        qCWarning(lcExport) << "Failed to read" << path << reader.errorString();
+    }
+    return image;
+}
@@ -0,0 +1,68 @@
+#ifndef BOOKEXPORTER_H
+#define BOOKEXPORTER_H
+
+#include <QImage>
+#include <QRect>
+#include <QStringList>
+#include <QVector>
+
+#include <functional>
+#include <memory>
+
+class QPainter;
+class QTextDocument;
+class QThread;
+
+// Экспорт всей инструкции в PDF или набор PNG листов.
+// Страницы готовятся параллельно в пуле потоков, одновременно - не больше
+// нескольких страниц: изображения, подписи и замечания читаются и
+// верстаются там же. В PDF растром идут только изображения шагов,
+// заголовки, подписи и замечания остаются текстом
+class BookExporter {
+public:
+    enum Format {
+        Pdf,
+        Png
+    };
+
+    // Вызывается из потока, запустившего экспорт; false - прервать экспорт
+    using ProgressCallback = std::function<bool(int done, int total)>;
+
+    explicit BookExporter(const QStringList &imagePaths);
+
+    void setStepsPerPage(int steps);
+    int stepsPerPage() const { return m_stepsPerPage; }
+    int pageCount() const;
+
+    bool exportTo(const QString &filePath, Format format, const ProgressCallback &progress = nullptr);
+    QString errorString() const { return m_errorString; }
+
+    static Format formatForFile(const QString &filePath);
+    // Имя PNG листа: book.png -> book_0001.png
+    static QString pngPagePath(const QString &filePath, int page);
+
+private:
+    // Содержимое ячейки шага, готовое к рисованию
+    struct StepContent {
+        QImage image;
+        std::shared_ptr<QTextDocument> caption; // Сверстана под ширину ячейки
+        QStringList notes;
+    };
+
+    QRect stepCell(int slot) const;
+    static QRect innerRect(const QRect &cell);
+    static QRect imageBox(const QRect &cell);
+    // Рабочий поток: документы подписей передаются потоку documentThread (nullptr - остаются в текущем)
+    QVector<StepContent> loadPageContent(int page, QThread *documentThread) const;
+    void paintPage(QPainter &painter, int page, const QVector<StepContent> &steps) const;
+    void drawStep(QPainter &painter, const QRect &cell, int step, const StepContent &content) const;
+    static QImage loadScaledImage(const QString &path, const QSize &box);
+
+    QStringList m_imagePaths;
+    int m_stepsPerPage;
+    int m_columns;
+    int m_rows;
+    QString m_errorString;
+};
+
+#endif // BOOKEXPORTER_H
@@ -0,0 +1,119 @@
+#include "bookpaths.h"
+#include "logging.h"
+#include "stepsource.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QFileInfo>
+#include <QTextStream>
+
+QString BookPaths::resourcesPath()
+{
+    return QCoreApplication::applicationDirPath() + "/resources";
+}
+
+QStringList BookPaths::findImagePaths()
+{
+    QDir resourcesDir(resourcesPath());
+    if (!resourcesDir.exists()) {
+        qCWarning(lcResources) << "Resources directory does not exist!";
+        // Создаем папку для демонстрации
+        resourcesDir.mkpath(".");
+    }
+
+    QStringList imageFilters = {"*.png", "*.jpg", "*.jpeg", "*.bmp"};
+    QStringList imagePaths = resourcesDir.entryList(imageFilters, QDir::Files);
+
+    for (QString &path : imagePaths) {
+        path = "resources/" + path;
+    }
+    imagePaths.sort();
+
+    // Архивы с шагами читаются без распаковки: из каждого берем изображения
+    // по индексу архива и добавляем после обычных файлов, архив за архивом
+    const QStringList archives = resourcesDir.entryList({"*.zip", "*.tar"}, QDir::Files, QDir::Name);
+    for (const QString &archiveName : archives) {
+        const QString archivePath = "resources/" + archiveName;
+        std::shared_ptr<StepSource> source = StepSource::archive(archivePath);
+        if (!source) continue;
+
+        QStringList members;
+        for (const QString &member : source->members()) {
+            if (QDir::match(imageFilters, QFileInfo(member).fileName())) {
+                members << StepSource::memberPath(archivePath, member);
+            }
+        }
+        members.sort();
+
+        qCDebug(lcResources) << "Found" << members.size() << "images in" << archivePath;
+        imagePaths << members;
+    }
+
+    qCDebug(lcResources) << "Found" << imagePaths.size() << "images";
+    return imagePaths;
+}
+
+QString BookPaths::captionFilePath(const QString &imagePath, CaptionView::Format *format)
+{
+    struct CaptionFile {
+        const char *suffix;
+        CaptionView::Format format;
+    };
+    static const CaptionFile captionFiles[] = {
+        { ".md", CaptionView::Markdown },
+        { ".html", CaptionView::Html },
+        { ".htm", CaptionView::Html },
+        { ".txt", CaptionView::PlainText },
+    };
+
+    QFileInfo imageInfo(imagePath);
+    QString basePath = imageInfo.absolutePath() + "/" + imageInfo.completeBaseName();
+
+    for (const CaptionFile &captionFile : captionFiles) {
+        QString textFilePath = basePath + captionFile.suffix;
+        if (!StepSource::stat(textFilePath).exists) continue;
+
+        if (format) {
+            *format = captionFile.format;
+        }
+        return textFilePath;
+    }
+    return QString();
+}
+
+QString BookPaths::loadCaption(const QString &imagePath, CaptionView::Format *format)
+{
+    // .txt - всегда обычный текст, разметка только в .md и .html
+    QString textFilePath = captionFilePath(imagePath, format);
+    if (textFilePath.isEmpty()) {
+        qCDebug(lcResources) << "Caption file not found for:" << imagePath;
+        return "";
+    }
+    return loadTextFromFile(textFilePath);
+}
+
+QString BookPaths::loadTextFromFile(const QString &filePath)
+{
+    if (!StepSource::stat(filePath).exists) {
+        qCDebug(lcResources) << "Text file not found:" << filePath;
+        return "";
+    }
+
+    // Файл может лежать и в архиве - тогда читается только он
+    std::unique_ptr<QIODevice> file = StepSource::openFile(filePath, QIODevice::ReadOnly | QIODevice::Text);
+    if (file) {
+        // Читаем файл с автоматическим определением кодировки
+        QTextStream in(file.get());
+        QString text = in.readAll();
+        file->close();
+
+        // Убираем лишние переносы строк в начале и конце
+        text = text.trimmed();
+
+        qCDebug(lcResources) << "Loaded text from:" << filePath << "Content:" << text.left(50) + "...";
+        return text;
+    }
+
+    qCWarning(lcResources) << "Failed to open text file:" << filePath;
+    return "";
+}
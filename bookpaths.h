@@ -0,0 +1,27 @@
+#ifndef BOOKPATHS_H
+#define BOOKPATHS_H
+
+#include <QString>
+#include <QStringList>
+
+#include "captionview.h"
+
+// Где лежат шаги инструкции и их подписи. Общие для окна и экспорта,
+// поэтому не зависят от MainWindow; пути шагов могут указывать в архив
+class BookPaths {
+public:
+    // Папка resources рядом с программой
+    static QString resourcesPath();
+    // Список шагов из папки resources: сначала обычные файлы, затем архивы
+    static QStringList findImagePaths();
+
+    // Файл подписи шага (пустая строка, если его нет) - без чтения содержимого
+    static QString captionFilePath(const QString &imagePath, CaptionView::Format *format = nullptr);
+    // Подпись шага из .md, .html или .txt файла рядом с изображением
+    // (пустая строка, если файла нет); format - в каком виде она записана
+    static QString loadCaption(const QString &imagePath, CaptionView::Format *format = nullptr);
+
+    static QString loadTextFromFile(const QString &filePath);
+};
+
+#endif // BOOKPATHS_H
@@ -0,0 +1,198 @@
+#include "captionview.h"
+
+#include <QAbstractTextDocumentLayout>
+#include <QEvent>
+#include <QPainter>
+#include <QPaintEvent>
+#include <QTextDocument>
+#include <QTextOption>
+#include <QtMath>
+
+namespace {
+
+const int ParsedCacheSize = 64;     // Шагов с разобранной подписью
+const int LayoutCacheSize = 256;    // Пар (шаг, ширина) со сверсткой
+
+quint64 layoutKey(int step, int width)
+{
+    return (quint64(quint32(step)) << 32) | quint32(width);
+}
+
+}
+
+CaptionView::CaptionView(QWidget *parent)
+    : QLabel(parent)
+    , m_step(-1)
+    , m_parsed(ParsedCacheSize)
+    , m_layouts(LayoutCacheSize)
+{
+}
+
+CaptionView::~CaptionView() { }
+
+void CaptionView::showMessage(const QString &text)
+{
+    m_step = -1;
+    QLabel::setText(text);
+}
+
+bool CaptionView::showCaption(int step, const QDateTime &modified)
+{
+    if (!m_parsed.contains(step) || m_modified.value(step) != modified) {
+        return false;
+    }
+
+    if (m_step != step) {
+        m_step = step;
+        QLabel::clear();
+        updateGeometry();
+        update();
+    }
+    return true;
+}
+
+void CaptionView::setCaption(int step, const QString &source, Format format, const QDateTime &modified)
+{
+    QTextDocument *document = createDocument(source, format);
+    document->setDefaultFont(font());
+
+    QTextOption option = document->defaultTextOption();
+    option.setAlignment(Qt::AlignHCenter);
+    option.setWrapMode(QTextOption::WrapAtWordBoundaryOrAnywhere);
+    document->setDefaultTextOption(option);
+
+    // Старые верстки этого шага больше не годятся
+    const QList<quint64> keys = m_layouts.keys();
+    for (quint64 key : keys) {
+        if (int(key >> 32) == step) {
+            m_layouts.remove(key);
+        }
+    }
+
+    m_parsed.insert(step, document);
+    m_modified.insert(step, modified);
+    m_step = -1;
+    showCaption(step, modified);
+}
+
+QTextDocument *CaptionView::createDocument(const QString &source, Format format)
+{
+    QTextDocument *document = new QTextDocument();
+    document->setDocumentMargin(0);
+
+    switch (format) {
+    case Markdown:
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+        document->setMarkdown(source);
+#else
+        document->setPlainText(source);
+#endif
+        break;
+    case Html:
+        document->setHtml(source);
+        break;
+    case PlainText:
+        document->setPlainText(source);
+        break;
+    }
+    return document;
+}
+
+QTextDocument *CaptionView::layoutFor(int width) const
+{
+    if (m_step < 0 || width <= 0) return nullptr;
+
+    const quint64 key = layoutKey(m_step, width);
+    if (QTextDocument *document = m_layouts.object(key)) {
+        return document;
+    }
+
+    QTextDocument *parsed = m_parsed.object(m_step);
+    if (!parsed) return nullptr;
+
+    // Копия разобранного документа - без повторного разбора Markdown/HTML
+    QTextDocument *document = parsed->clone();
+    document->setDefaultFont(parsed->defaultFont());
+    document->setDefaultTextOption(parsed->defaultTextOption());
+    document->setTextWidth(width);
+    document->documentLayout()->documentSize(); // Верстаем сразу, а не при первой отрисовке
+
+    if (!m_layouts.insert(key, document)) {
+        return nullptr;
+    }
+    return document;
+}
+
+int CaptionView::verticalChrome() const
+{
+    return height() - contentsRect().height();
+}
+
+QSize CaptionView::sizeHint() const
+{
+    if (m_step < 0) return QLabel::sizeHint();
+
+    QSize hint = QLabel::sizeHint();
+    hint.setHeight(heightForWidth(width()));
+    return hint;
+}
+
+QSize CaptionView::minimumSizeHint() const
+{
+    if (m_step < 0) return QLabel::minimumSizeHint();
+    return QSize(0, minimumHeight());
+}
+
+bool CaptionView::hasHeightForWidth() const
+{
+    return m_step >= 0 || QLabel::hasHeightForWidth();
+}
+
+int CaptionView::heightForWidth(int width) const
+{
+    if (m_step < 0) return QLabel::heightForWidth(width);
+
+    const int chrome = verticalChrome();
+    QTextDocument *document = layoutFor(width - (this->width() - contentsRect().width()));
+    if (!document) return chrome;
+
+    return qCeil(document->size().height()) + chrome;
+}
+
+void CaptionView::paintEvent(QPaintEvent *event)
+{
+    // Фон, рамку и обычный текст рисует QLabel; в режиме подписи текст у него пустой
+    QLabel::paintEvent(event);
+
+    QRect area = contentsRect();
+    QTextDocument *document = layoutFor(area.width());
+    if (!document) return;
+
+    QPainter painter(this);
+    painter.setClipRect(area.intersected(event->rect()));
+
+    // Центрируем по вертикали, как AlignCenter у QLabel
+    const qreal documentHeight = document->size().height();
+    const qreal top = area.top() + qMax<qreal>(0, (area.height() - documentHeight) / 2);
+    painter.translate(area.left(), top);
+
+    QAbstractTextDocumentLayout::PaintContext context;
+    context.palette = palette();
+    context.palette.setColor(QPalette::Text, palette().color(foregroundRole()));
+    context.clip = QRectF(event->rect().translated(-area.left(), -qRound(top)));
+    document->documentLayout()->draw(&painter, context);
+}
+
+void CaptionView::changeEvent(QEvent *event)
+{
+    QLabel::changeEvent(event);
+
+    // Шрифт приходит из таблицы стилей - готовая верстка с другим шрифтом не годится
+    if (event->type() == QEvent::FontChange) {
+        m_layouts.clear();
+        const QList<int> steps = m_parsed.keys();
+        for (int step : steps) {
+            m_parsed.object(step)->setDefaultFont(font());
+        }
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef CAPTIONVIEW_H
+#define CAPTIONVIEW_H
+
+#include <QLabel>
+#include <QCache>
+#include <QDateTime>
+#include <QHash>
+
+class QTextDocument;
+
+// Подпись под изображением с поддержкой Markdown/HTML.
+// Разобранный документ кэшируется по шагу, сверстанный - по паре (шаг, ширина),
+// поэтому возврат к шагу или повторный resize не требуют разбора и верстки заново;
+// правка файла подписи (другой mtime) сбрасывает кэш шага.
+class CaptionView : public QLabel {
+    Q_OBJECT
+
+public:
+    enum Format {
+        PlainText,
+        Markdown,
+        Html
+    };
+
+    explicit CaptionView(QWidget *parent = nullptr);
+    ~CaptionView();
+
+    // Служебное сообщение вместо подписи ("Готов к работе", ошибки загрузки);
+    // следующий showCaption() вернет подпись шага
+    void showMessage(const QString &text);
+
+    // Показывает подпись шага из кэша; false - подписи в кэше нет или она
+    // разобрана из файла с другим mtime, нужен setCaption()
+    bool showCaption(int step, const QDateTime &modified);
+    void setCaption(int step, const QString &source, Format format, const QDateTime &modified);
+
+    // Новый документ без верстки; безопасно вызывать из рабочих потоков
+    static QTextDocument *createDocument(const QString &source, Format format);
+
+    QSize sizeHint() const override;
+    QSize minimumSizeHint() const override;
+    bool hasHeightForWidth() const override;
+    int heightForWidth(int width) const override;
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+    void changeEvent(QEvent *event) override;
+
+private:
+    QTextDocument *layoutFor(int width) const;
+    int verticalChrome() const;
+
+    int m_step;                                    // -1: показывается обычный текст QLabel
+    mutable QCache<int, QTextDocument> m_parsed;   // Разобранные подписи по шагам
+    mutable QCache<quint64, QTextDocument> m_layouts; // Сверстанные подписи по (шаг, ширина)
+    QHash<int, QDateTime> m_modified;              // mtime файла, из которого разобрана подпись шага
+};
+
+#endif // CAPTIONVIEW_H
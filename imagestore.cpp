@@ -0,0 +1,492 @@
+#include "imagestore.h"
+#include "logging.h"
+#include "stepsource.h"
+
+#include <QBuffer>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QImageReader>
+
+namespace {
+
+// Сколько декодированных изображений полного размера держать в памяти
+const int PixmapCacheKb = 256 * 1024;
+
+// Один 64-битный проход qHashBits плюс размер файла: коллизия потребовала
+// бы совпадения хэша у файлов одной длины
+const size_t HashSeed = 0x9e3779b9u;
+
+// Приоритеты задач в пуле: изображение текущего и соседних шагов обгоняет
+// очередь миниатюр, построенную при открытии ленты шагов
+const int ImagePriority = 1;
+const int ThumbnailPriority = 0;
+
+int pixmapCost(const QPixmap &pixmap)
+{
+    return qMax(1, int(qint64(pixmap.width()) * pixmap.height() * pixmap.depth() / 8 / 1024));
+}
+
+// Форматы, которые растровый QPixmap принимает без преобразования:
+// непрозрачные - RGB32, с альфа-каналом - ARGB32_Premultiplied
+QImage::Format displayFormat(const QImage &image)
+{
+    return image.hasAlphaChannel() ? QImage::Format_ARGB32_Premultiplied : QImage::Format_RGB32;
+}
+
+QByteArray contentKeyFromHash(qint64 size, quint64 hash)
+{
+    QByteArray key;
+    key.reserve(2 * sizeof(quint64));
+    key.append(reinterpret_cast<const char *>(&size), sizeof(size));
+    key.append(reinterpret_cast<const char *>(&hash), sizeof(hash));
+    return key;
+}
+
+}
+
+const QSize ImageStore::ThumbnailSize(40, 30);
+
+ImageStore::ImageStore(QObject *parent)
+    : QObject(parent)
+    , m_pixmaps(PixmapCacheKb)
+{
+}
+
+ImageStore::~ImageStore()
+{
+    // Рабочие потоки обращаются к this только через очередь событий,
+    // но сами задачи должны завершиться до разрушения пула
+    m_pool.clear();
+    m_pool.waitForDone();
+}
+
+ImageStore::Loaded ImageStore::loadFile(const Request &request)
+{
+    Loaded loaded;
+    loaded.decoded.path = request.path;
+
+    const StepSource::FileStat info = StepSource::stat(request.path);
+    if (!info.exists) {
+        return loaded;
+    }
+    loaded.entry.size = info.size;
+    loaded.entry.modified = info.modified;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    // Файл читается один раз: из этих же байтов считается ключ и декодируется изображение.
+    // Обычный файл отображаем в память, член архива распаковываем целиком
+    QFile file;
+    uchar *mapped = nullptr;
+    QByteArray bytes;
+    if (StepSource::splitPath(request.path, nullptr, nullptr)) {
+        bytes = StepSource::readFile(request.path);
+    } else {
+        file.setFileName(request.path);
+        if (file.open(QIODevice::ReadOnly)) {
+            mapped = info.size > 0 ? file.map(0, info.size) : nullptr;
+            bytes = mapped ? QByteArray::fromRawData(reinterpret_cast<const char *>(mapped), int(info.size))
+                           : file.readAll();
+        }
+    }
+    if (bytes.size() != info.size) {
+        return loaded;
+    }
+
+    loaded.entry.contentKey = contentKeyFromHash(info.size, qHashBits(bytes.constData(), size_t(bytes.size()), HashSeed));
+    loaded.hashUs = timer.nsecsElapsed() / 1000;
+
+    QBuffer buffer(&bytes);
+    buffer.open(QIODevice::ReadOnly);
+    loaded.decoded = decodeImage(request, &buffer);
+    loaded.decoded.contentKey = loaded.entry.contentKey;
+    loaded.entry.imageSize = loaded.decoded.imageSize;
+
+    // Декодированное изображение уже не ссылается на байты файла
+    buffer.close();
+    if (mapped) {
+        bytes.clear();
+        file.unmap(mapped);
+    }
+    return loaded;
+}
+
+QByteArray ImageStore::contentKeyTag()
+{
+    static const char probe[] = "flipbook content key";
+    const quint64 probeHash = qHashBits(probe, sizeof(probe) - 1, HashSeed);
+    return QByteArray(QT_VERSION_STR) + '/' + QByteArray::number(probeHash, 16);
+}
+
+QByteArray ImageStore::knownContentKey(const QString &path) const
+{
+    // Только stat: ключ годится, если файл не менялся с момента хэширования
+    auto it = m_files.constFind(path);
+    if (it == m_files.constEnd() || it->contentKey.isEmpty()) {
+        return QByteArray();
+    }
+
+    const StepSource::FileStat info = StepSource::stat(path);
+    if (info.size != it->size || info.modified != it->modified) {
+        return QByteArray();
+    }
+    return it->contentKey;
+}
+
+QByteArray ImageStore::jobKey(const QByteArray &contentKey, Kind kind, const QSize &fitTo)
+{
+    QByteArray key = contentKey;
+    key += char(kind);
+    key += QByteArray::number(fitTo.width()) + 'x' + QByteArray::number(fitTo.height());
+    return key;
+}
+
+QByteArray ImageStore::loadKey(const Request &request)
+{
+    // Пока ключ содержимого неизвестен, одинаковые запросы склеиваются по пути
+    return jobKey(request.path.toUtf8(), request.kind, request.fitTo);
+}
+
+int ImageStore::priority(Kind kind)
+{
+    return kind == FullImage ? ImagePriority : ThumbnailPriority;
+}
+
+void ImageStore::requestImage(const QString &path, const QSize &fitTo)
+{
+    enqueue({ path, FullImage, fitTo });
+}
+
+void ImageStore::requestThumbnail(const QString &path)
+{
+    enqueue({ path, Thumbnail, ThumbnailSize });
+}
+
+QPixmap ImageStore::cachedPixmap(const QString &path, const QSize &fitTo)
+{
+    const QByteArray key = knownContentKey(path);
+    if (key.isEmpty()) {
+        return QPixmap();
+    }
+
+    QPixmap *cached = m_pixmaps.object(jobKey(key, FullImage, fitTo));
+    return cached ? *cached : QPixmap();
+}
+
+QPixmap ImageStore::cachedThumbnail(const QString &path)
+{
+    const QByteArray key = knownContentKey(path);
+    return key.isEmpty() ? QPixmap() : m_thumbnails.value(key);
+}
+
+void ImageStore::enqueue(const Request &request)
+{
+    const QByteArray key = knownContentKey(request.path);
+    if (!key.isEmpty()) {
+        resolve(request, key);
+        return;
+    }
+
+    // Ключ неизвестен - одна задача читает файл, хэширует и декодирует его;
+    // совпадение содержимого с другими файлами проверяется по приходу результата
+    const QByteArray job = loadKey(request);
+    const bool loading = m_loading.contains(job);
+    m_loading.insert(job, request);
+    if (!loading) {
+        startLoad(request);
+    }
+}
+
+bool ImageStore::findCached(const Request &request, const QByteArray &contentKey, QPixmap *pixmap) const
+{
+    if (request.kind == Thumbnail) {
+        auto it = m_thumbnails.constFind(contentKey);
+        if (it == m_thumbnails.constEnd()) {
+            return false;
+        }
+        *pixmap = it.value();
+        return true;
+    }
+
+    QPixmap *cached = m_pixmaps.object(jobKey(contentKey, FullImage, request.fitTo));
+    if (!cached) {
+        return false;
+    }
+    *pixmap = *cached;
+    return true;
+}
+
+void ImageStore::resolve(const Request &request, const QByteArray &contentKey)
+{
+    // То же содержимое уже декодировано - под этим или другим именем файла
+    QPixmap cached;
+    if (findCached(request, contentKey, &cached)) {
+        deliver(request, cached);
+        return;
+    }
+
+    // То же содержимое уже декодируется - ждем готовый результат
+    const QByteArray job = jobKey(contentKey, request.kind, request.fitTo);
+    const bool decoding = m_decoding.contains(job);
+    m_decoding.insert(job, request);
+    if (!decoding) {
+        startDecode(request, contentKey);
+    }
+}
+
+void ImageStore::startLoad(const Request &request)
+{
+    m_pool.start([this, request]() {
+        Loaded loaded = loadFile(request);
+
+        QMetaObject::invokeMethod(this, [this, request, loaded = std::move(loaded)]() mutable {
+            finishLoad(request, std::move(loaded));
+        }, Qt::QueuedConnection);
+    }, priority(request.kind));
+}
+
+void ImageStore::finishLoad(const Request &request, Loaded loaded)
+{
+    qCDebug(lcPerf) << request.path << "hash" << loaded.hashUs << "us";
+
+    const QByteArray job = loadKey(request);
+    const QList<Request> waiting = m_loading.values(job);
+    m_loading.remove(job);
+
+    const QByteArray contentKey = loaded.entry.contentKey;
+    if (contentKey.isEmpty()) {
+        for (const Request &waitingRequest : waiting) {
+            deliver(waitingRequest, QPixmap());
+        }
+        return;
+    }
+
+    // Размер из заголовка, прочитанный раньше, остается в записи
+    FileEntry &file = m_files[request.path];
+    if (!loaded.entry.imageSize.isValid() && file.size == loaded.entry.size && file.modified == loaded.entry.modified) {
+        loaded.entry.imageSize = file.imageSize;
+    }
+    file = loaded.entry;
+
+    // То же содержимое могло прийти раньше под другим именем - отдаем общий pixmap
+    QPixmap pixmap;
+    if (!findCached(request, contentKey, &pixmap)) {
+        pixmap = store(request, std::move(loaded.decoded));
+    }
+    for (const Request &waitingRequest : waiting) {
+        deliver(waitingRequest, pixmap);
+    }
+}
+
+void ImageStore::startDecode(const Request &request, const QByteArray &contentKey)
+{
+    m_pool.start([this, request, contentKey]() {
+        Decoded decoded = decodeFile(request);
+        decoded.contentKey = contentKey;
+
+        // Передаем изображение перемещением: единственная ссылка на пиксели
+        // позволяет QPixmap::fromImage забрать их без копирования
+        QMetaObject::invokeMethod(this, [this, request, decoded = std::move(decoded)]() mutable {
+            finishDecode(request, std::move(decoded));
+        }, Qt::QueuedConnection);
+    }, priority(request.kind));
+}
+
+ImageStore::Decoded ImageStore::decodeFile(const Request &request)
+{
+    std::unique_ptr<QIODevice> device = StepSource::openFile(request.path);
+    if (!device) {
+        Decoded decoded;
+        decoded.path = request.path;
+        return decoded;
+    }
+    return decodeImage(request, device.get());
+}
+
+ImageStore::Decoded ImageStore::decodeImage(const Request &request, QIODevice *device)
+{
+    Decoded decoded;
+    decoded.path = request.path;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QImageReader reader(device, QFileInfo(request.path).suffix().toLatin1());
+    decoded.imageSize = reader.size();
+
+    // Для миниатюры просим декодер сразу выдать уменьшенную копию
+    // (в двойном размере, чтобы потом сгладить)
+    if (request.kind == Thumbnail && decoded.imageSize.isValid()) {
+        QSize decodeSize = decoded.imageSize.scaled(ThumbnailSize * 2, Qt::KeepAspectRatio);
+        if (decodeSize.width() < decoded.imageSize.width()) {
+            reader.setScaledSize(decodeSize);
+        }
+    }
+
+    QImage image = reader.read();
+    decoded.decodeUs = timer.nsecsElapsed() / 1000;
+
+    if (image.isNull()) {
+        qCWarning(lcResources) << "Failed to decode" << request.path << reader.errorString();
+        return decoded;
+    }
+    if (!decoded.imageSize.isValid()) {
+        decoded.imageSize = image.size();
+    }
+
+    // RGB32/индексированные/серые изображения переводим в формат pixmap здесь,
+    // а не при отрисовке в GUI-потоке
+    timer.restart();
+    const QImage::Format format = displayFormat(image);
+    if (image.format() != format) {
+        image = image.convertToFormat(format);
+    }
+    decoded.convertUs = timer.nsecsElapsed() / 1000;
+
+    timer.restart();
+    const QSize fitTo = request.kind == Thumbnail ? ThumbnailSize : request.fitTo;
+    if (fitTo.isValid() && (image.width() > fitTo.width() || image.height() > fitTo.height())) {
+        image = image.scaled(fitTo, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    }
+    decoded.scaleUs = timer.nsecsElapsed() / 1000;
+
+    decoded.image = image;
+    return decoded;
+}
+
+void ImageStore::finishDecode(const Request &request, Decoded decoded)
+{
+    const QByteArray job = jobKey(decoded.contentKey, request.kind, request.fitTo);
+    const QPixmap pixmap = store(request, std::move(decoded));
+
+    const QList<Request> waiting = m_decoding.values(job);
+    m_decoding.remove(job);
+    for (const Request &waitingRequest : waiting) {
+        deliver(waitingRequest, pixmap);
+    }
+}
+
+QPixmap ImageStore::store(const Request &request, Decoded decoded)
+{
+    // Единственная работа GUI-потока: загрузить готовые пиксели в QPixmap
+    QElapsedTimer timer;
+    timer.start();
+    QPixmap pixmap;
+    if (!decoded.image.isNull()) {
+        pixmap = QPixmap::fromImage(std::move(decoded.image), Qt::NoFormatConversion);
+    }
+    const qint64 uploadUs = timer.nsecsElapsed() / 1000;
+
+    qCDebug(lcPerf) << decoded.path << (request.kind == Thumbnail ? "thumbnail" : "image")
+                    << "decode" << decoded.decodeUs << "us"
+                    << "convert" << decoded.convertUs << "us"
+                    << "scale" << decoded.scaleUs << "us"
+                    << "upload" << uploadUs << "us";
+
+    if (decoded.imageSize.isValid()) {
+        m_sizes.insert(decoded.contentKey, decoded.imageSize);
+    }
+
+    if (request.kind == Thumbnail) {
+        // Неудачная миниатюра тоже запоминается, чтобы не декодировать файл снова
+        m_thumbnails.insert(decoded.contentKey, pixmap);
+    } else if (!pixmap.isNull()) {
+        m_pixmaps.insert(jobKey(decoded.contentKey, FullImage, request.fitTo), new QPixmap(pixmap), pixmapCost(pixmap));
+    }
+    return pixmap;
+}
+
+void ImageStore::deliver(const Request &request, const QPixmap &pixmap)
+{
+    if (request.kind == Thumbnail) {
+        emit thumbnailReady(request.path, pixmap);
+    } else {
+        emit imageReady(request.path, request.fitTo, pixmap);
+    }
+}
+
+QVector<ImageStore::WarmEntry> ImageStore::warmEntries(const QStringList &paths) const
+{
+    QVector<WarmEntry> entries;
+    entries.reserve(paths.size());
+
+    for (const QString &path : paths) {
+        auto file = m_files.constFind(path);
+        if (file == m_files.constEnd() || file->contentKey.isEmpty()) continue;
+
+        WarmEntry entry;
+        entry.path = path;
+        entry.size = file->size;
+        entry.modifiedMs = file->modified.toMSecsSinceEpoch();
+        entry.contentKey = file->contentKey;
+        entry.imageSize = m_sizes.value(file->contentKey);
+        entry.thumbnail = m_thumbnails.value(file->contentKey).toImage();
+        entries.append(entry);
+    }
+    return entries;
+}
+
+int ImageStore::restoreWarmEntries(const QVector<WarmEntry> &entries)
+{
+    int restored = 0;
+    for (const WarmEntry &entry : entries) {
+        // Только stat, без чтения содержимого
+        const StepSource::FileStat info = StepSource::stat(entry.path);
+        if (!info.exists || info.size != entry.size
+            || info.modified.toMSecsSinceEpoch() != entry.modifiedMs) {
+            continue;
+        }
+
+        FileEntry &file = m_files[entry.path];
+        file.size = entry.size;
+        file.modified = info.modified;
+        file.contentKey = entry.contentKey;
+
+        if (entry.imageSize.isValid()) {
+            m_sizes.insert(entry.contentKey, entry.imageSize);
+        }
+        if (!entry.thumbnail.isNull() && !m_thumbnails.contains(entry.contentKey)) {
+            m_thumbnails.insert(entry.contentKey, QPixmap::fromImage(entry.thumbnail));
+        }
+        ++restored;
+    }
+    return restored;
+}
+
+QSize ImageStore::imageSize(const QString &path)
+{
+    const StepSource::FileStat info = StepSource::stat(path);
+    if (!info.exists) {
+        return QSize();
+    }
+
+    // Запись о файле годится, пока у него прежние размер и mtime
+    FileEntry &entry = m_files[path];
+    if (entry.size != info.size || entry.modified != info.modified) {
+        entry = FileEntry();
+        entry.size = info.size;
+        entry.modified = info.modified;
+    }
+    if (entry.imageSize.isValid()) {
+        return entry.imageSize;
+    }
+    if (!entry.contentKey.isEmpty()) {
+        entry.imageSize = m_sizes.value(entry.contentKey);
+        if (entry.imageSize.isValid()) {
+            return entry.imageSize;
+        }
+    }
+
+    // Размер читаем из заголовка, без декодирования пикселей и без хэширования;
+    // член архива при этом распаковывается только до конца заголовка
+    std::unique_ptr<QIODevice> device = StepSource::openFile(path);
+    if (device) {
+        entry.imageSize = QImageReader(device.get(), QFileInfo(path).suffix().toLatin1()).size();
+    }
+    if (entry.imageSize.isValid() && !entry.contentKey.isEmpty()) {
+        m_sizes.insert(entry.contentKey, entry.imageSize);
+    }
+    return entry.imageSize;
+}
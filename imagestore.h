@@ -0,0 +1,142 @@
+#ifndef IMAGESTORE_H
+#define IMAGESTORE_H
+
+#include <QObject>
+#include <QCache>
+#include <QDateTime>
+#include <QHash>
+#include <QImage>
+#include <QMultiHash>
+#include <QPixmap>
+#include <QSize>
+#include <QString>
+#include <QThreadPool>
+#include <QVector>
+
+// Хранилище изображений шагов с дедупликацией по содержимому.
+// Одинаковые файлы под разными именами получают один ключ содержимого
+// и делят один декодированный pixmap, одну миниатюру и одну запись о размере.
+//
+// Хэширование, декодирование, перевод в формат для отрисовки и
+// масштабирование выполняются в рабочих потоках; GUI-поток только
+// создает QPixmap из готового QImage. Файл с еще неизвестным ключом
+// читается один раз: одна задача и хэширует, и декодирует его байты.
+// Результаты приходят сигналами
+class QIODevice;
+
+class ImageStore : public QObject {
+    Q_OBJECT
+
+public:
+    explicit ImageStore(QObject *parent = nullptr);
+    ~ImageStore();
+
+    // Ключ содержимого файла, если он уже посчитан и файл с тех пор не менялся
+    // (только stat, без чтения). Пустой - хэш посчитает в рабочем потоке
+    // ближайший requestImage() или requestThumbnail()
+    QByteArray knownContentKey(const QString &path) const;
+
+    // Метка алгоритма ключей содержимого: версия Qt и хэш контрольной строки.
+    // Результат qHashBits зависит от версии Qt и ветки процессора, поэтому
+    // ключи, сохраненные с другой меткой, использовать нельзя
+    static QByteArray contentKeyTag();
+
+    // Изображение, вписанное в fitTo (пустой размер - без масштабирования).
+    // Если оно уже в кэше, imageReady испускается сразу
+    void requestImage(const QString &path, const QSize &fitTo = QSize());
+    QPixmap cachedPixmap(const QString &path, const QSize &fitTo = QSize());
+
+    void requestThumbnail(const QString &path);
+    QPixmap cachedThumbnail(const QString &path);
+
+    // Размер из заголовка файла, без декодирования пикселей
+    QSize imageSize(const QString &path);
+
+    // Запись для снимка сессии: всё, чтобы при следующем запуске не
+    // хэшировать и не декодировать неизменившийся файл заново
+    struct WarmEntry {
+        QString path;
+        qint64 size = -1;
+        qint64 modifiedMs = 0;
+        QByteArray contentKey;
+        QSize imageSize;
+        QImage thumbnail;
+    };
+
+    QVector<WarmEntry> warmEntries(const QStringList &paths) const;
+    // Принимает только записи, у которых файл на диске не менялся; возвращает их число
+    int restoreWarmEntries(const QVector<WarmEntry> &entries);
+
+    static const QSize ThumbnailSize;
+
+signals:
+    void imageReady(const QString &path, const QSize &fitTo, const QPixmap &pixmap);
+    void thumbnailReady(const QString &path, const QPixmap &thumbnail);
+
+private:
+    enum Kind {
+        FullImage,
+        Thumbnail
+    };
+
+    struct FileEntry {
+        qint64 size = -1;
+        QDateTime modified;
+        QByteArray contentKey;      // Пустой - файл еще не хэширован
+        QSize imageSize;            // Из заголовка; известен и без хэша
+    };
+
+    struct Request {
+        QString path;
+        Kind kind;
+        QSize fitTo;
+    };
+
+    // Результат рабочего потока; время стадий в микросекундах
+    struct Decoded {
+        QString path;
+        QByteArray contentKey;
+        QSize imageSize;
+        QImage image;
+        qint64 decodeUs = 0;
+        qint64 convertUs = 0;
+        qint64 scaleUs = 0;
+    };
+
+    // Результат задачи, которая читает файл с неизвестным ключом: запись о файле
+    // (пустой ключ - файл не прочитан) и изображение из тех же байтов
+    struct Loaded {
+        FileEntry entry;
+        Decoded decoded;
+        qint64 hashUs = 0;
+    };
+
+    static QByteArray jobKey(const QByteArray &contentKey, Kind kind, const QSize &fitTo);
+    static QByteArray loadKey(const Request &request);
+    static int priority(Kind kind);
+
+    void enqueue(const Request &request);
+    void resolve(const Request &request, const QByteArray &contentKey);
+    bool findCached(const Request &request, const QByteArray &contentKey, QPixmap *pixmap) const;
+    void startLoad(const Request &request);
+    void finishLoad(const Request &request, Loaded loaded);
+    void startDecode(const Request &request, const QByteArray &contentKey);
+    void finishDecode(const Request &request, Decoded decoded);
+    QPixmap store(const Request &request, Decoded decoded);
+    void deliver(const Request &request, const QPixmap &pixmap);
+
+    static Loaded loadFile(const Request &request);
+    static Decoded decodeFile(const Request &request);
+    static Decoded decodeImage(const Request &request, QIODevice *device);
+
+    QHash<QString, FileEntry> m_files;          // Путь -> ключ содержимого и размер изображения
+    QCache<QByteArray, QPixmap> m_pixmaps;      // Изображения по (ключ, размер), стоимость в КБ
+    QHash<QByteArray, QPixmap> m_thumbnails;    // Миниатюры по ключу содержимого
+    QHash<QByteArray, QSize> m_sizes;           // Размеры по ключу содержимого
+
+    QMultiHash<QByteArray, Request> m_loading;  // Запросы к файлам с неизвестным ключом, по loadKey
+    QMultiHash<QByteArray, Request> m_decoding; // Запросы, ждущие декодирования содержимого
+    QThreadPool m_pool;
+};
+
+#endif // IMAGESTORE_H
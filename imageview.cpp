@@ -0,0 +1,142 @@
+#include "imageview.h"
+#include "logging.h"
+
+#include <QPainter>
+#include <QPen>
+#include <QPaintEvent>
+
+ImageView::ImageView(QWidget *parent)
+    : QLabel(parent)
+{
+}
+
+ImageView::~ImageView() { }
+
+void ImageView::showMessage(const QString &text)
+{
+    m_image = QPixmap();
+    m_backing = QPixmap();
+    m_highlights.clear();
+    QLabel::setText(text);
+    updateGeometry();
+}
+
+void ImageView::setImage(const QPixmap &image)
+{
+    QLabel::clear();
+    m_image = image;
+    m_highlights.clear();
+    updateBacking();
+    updateGeometry();
+    update();
+}
+
+void ImageView::setFitSize(const QSize &fitSize)
+{
+    if (m_fitSize == fitSize) return;
+
+    m_fitSize = fitSize;
+    if (!m_image.isNull()) {
+        updateBacking();
+        updateGeometry();
+        update();
+    }
+}
+
+void ImageView::updateBacking()
+{
+    // Масштабируем один раз на изображение и размер области; resize окна
+    // и наведение на кнопки подложку не пересчитывают
+    if (m_image.isNull() || !m_fitSize.isValid()
+        || (m_image.width() <= m_fitSize.width() && m_image.height() <= m_fitSize.height())) {
+        m_backing = m_image;
+        return;
+    }
+    m_backing = m_image.scaled(m_fitSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    qCDebug(lcLayout) << "Image backing scaled to" << m_backing.size();
+}
+
+QRect ImageView::imageRect() const
+{
+    if (m_backing.isNull()) {
+        return QRect();
+    }
+    QRect area = contentsRect();
+    QRect target(QPoint(0, 0), m_backing.size());
+    target.moveCenter(area.center());
+    return target;
+}
+
+void ImageView::setHighlights(const QVector<QRect> &regions)
+{
+    if (m_highlights == regions) return;
+
+    // Перерисовываем только старые и новые рамки
+    const QRect before = highlightsBounds();
+    m_highlights = regions;
+    update(before | highlightsBounds());
+}
+
+QRect ImageView::highlightRect(const QRect &region, const QRect &target) const
+{
+    // Подложка может быть уменьшена относительно исходного изображения
+    const qreal scaleX = qreal(target.width()) / m_image.width();
+    const qreal scaleY = qreal(target.height()) / m_image.height();
+    return QRectF(target.x() + region.x() * scaleX, target.y() + region.y() * scaleY,
+                  region.width() * scaleX, region.height() * scaleY).toAlignedRect();
+}
+
+QRect ImageView::highlightsBounds() const
+{
+    const QRect target = imageRect();
+    QRect bounds;
+    if (target.isEmpty()) return bounds;
+
+    for (const QRect &region : m_highlights) {
+        bounds |= highlightRect(region, target);
+    }
+    // Запас на толщину пера
+    return bounds.isEmpty() ? bounds : bounds.adjusted(-2, -2, 2, 2);
+}
+
+QSize ImageView::sizeHint() const
+{
+    if (m_backing.isNull()) {
+        return QLabel::sizeHint();
+    }
+    // Как у QLabel с pixmap: изображение плюс рамка и отступы
+    return m_backing.size() + (size() - contentsRect().size());
+}
+
+QSize ImageView::minimumSizeHint() const
+{
+    return m_backing.isNull() ? QLabel::minimumSizeHint() : sizeHint();
+}
+
+void ImageView::paintEvent(QPaintEvent *event)
+{
+    // Фон, рамку и текст рисует QLabel; при показе изображения текст у него пустой
+    QLabel::paintEvent(event);
+
+    const QRect target = imageRect();
+    if (target.isEmpty()) return;
+
+    // Копируем только пересечение грязной области с подложкой, один к одному
+    QPainter painter(this);
+    for (const QRect &dirty : event->region()) {
+        const QRect area = dirty.intersected(target);
+        if (area.isEmpty()) continue;
+        painter.drawPixmap(area, m_backing, area.translated(-target.topLeft()));
+    }
+
+    if (m_highlights.isEmpty()) return;
+
+    painter.setPen(QPen(QColor(255, 87, 34), 3));
+    painter.setBrush(QColor(255, 87, 34, 40));
+    for (const QRect &region : m_highlights) {
+        const QRect mapped = highlightRect(region, target);
+        if (mapped.adjusted(-2, -2, 2, 2).intersects(event->rect())) {
+            painter.drawRect(mapped.adjusted(1, 1, -1, -1));
+        }
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef IMAGEVIEW_H
+#define IMAGEVIEW_H
+
+#include <QLabel>
+#include <QPixmap>
+#include <QVector>
+
+// Область изображения шага под полупрозрачными кнопками навигации.
+// Держит готовую подложку - изображение, уже вписанное в fitSize, - и при
+// перерисовке копирует из нее только грязные прямоугольники: наведение на
+// кнопку стоит столько, сколько площадь кнопки, а не всего изображения.
+class ImageView : public QLabel {
+    Q_OBJECT
+
+public:
+    explicit ImageView(QWidget *parent = nullptr);
+    ~ImageView();
+
+    // Текст вместо изображения (приветствие, "Загрузка...", ошибки):
+    // изображение, подложка и подсветка сбрасываются
+    void showMessage(const QString &text);
+
+    void setImage(const QPixmap &image);
+    QPixmap image() const { return m_image; }
+
+    // Больший размер изображение уменьшается с сохранением пропорций,
+    // меньшее центрируется как есть; пустой размер - без масштабирования
+    void setFitSize(const QSize &fitSize);
+
+    // Где на виджете лежит подложка (пустой - изображения нет)
+    QRect imageRect() const;
+
+    // Рамки поверх изображения (измененные области), в координатах image();
+    // сбрасываются при смене изображения
+    void setHighlights(const QVector<QRect> &regions);
+
+    QSize sizeHint() const override;
+    QSize minimumSizeHint() const override;
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+
+private:
+    void updateBacking();
+    QRect highlightRect(const QRect &region, const QRect &target) const;
+    QRect highlightsBounds() const;
+
+    QPixmap m_image;     // Исходное изображение шага
+    QPixmap m_backing;   // Вписанное в m_fitSize, готовое к копированию
+    QSize m_fitSize;
+    QVector<QRect> m_highlights;
+};
+
+#endif // IMAGEVIEW_H
@@ -0,0 +1,112 @@
+#include "logging.h"
+
+#include <QMutex>
+#include <QMutexLocker>
+#include <QVector>
+
+#include <cstdio>
+#include <cstring>
+
+Q_LOGGING_CATEGORY(lcLayout, "flipbook.layout", QtInfoMsg)
+Q_LOGGING_CATEGORY(lcNavigation, "flipbook.navigation", QtInfoMsg)
+Q_LOGGING_CATEGORY(lcResources, "flipbook.resources", QtInfoMsg)
+Q_LOGGING_CATEGORY(lcNotes, "flipbook.notes", QtInfoMsg)
+Q_LOGGING_CATEGORY(lcExport, "flipbook.export", QtInfoMsg)
+Q_LOGGING_CATEGORY(lcPerf, "flipbook.perf", QtInfoMsg)
+
+namespace {
+
+struct BufferedMessage {
+    QtMsgType type = QtDebugMsg;
+    const char *category = nullptr; // Имена категорий - статические строки
+    QString message;
+};
+
+QMutex ringMutex;
+QVector<BufferedMessage> ring;
+int ringNext = 0;
+int ringCount = 0;
+QtMessageHandler previousHandler = nullptr;
+
+void forward(QtMsgType type, const QMessageLogContext &context, const QString &message)
+{
+    if (previousHandler) {
+        previousHandler(type, context, message);
+    } else {
+        std::fprintf(stderr, "%s\n", qPrintable(qFormatLogMessage(type, context, message)));
+    }
+}
+
+bool isFlipbookCategory(const char *category)
+{
+    return category && std::strncmp(category, "flipbook.", 9) == 0;
+}
+
+void ringHandler(QtMsgType type, const QMessageLogContext &context, const QString &message)
+{
+    // В буфер идет только отладка самого приложения; info (в том числе
+    // итог экспорта и сообщения Qt) выводится сразу
+    if (type == QtDebugMsg && isFlipbookCategory(context.category)) {
+        QMutexLocker locker(&ringMutex);
+        if (!ring.isEmpty()) {
+            BufferedMessage &slot = ring[ringNext];
+            slot.type = type;
+            slot.category = context.category;
+            slot.message = message;
+            ringNext = (ringNext + 1) % ring.size();
+            ringCount = qMin(ringCount + 1, ring.size());
+        }
+        return;
+    }
+
+    // Предупреждение или ошибка: сначала контекст из буфера, потом само сообщение
+    if (type != QtDebugMsg && type != QtInfoMsg) {
+        Logging::flushRingBuffer();
+    }
+    forward(type, context, message);
+}
+
+}
+
+namespace Logging {
+
+void installRingBuffer(int capacity)
+{
+    if (capacity <= 0) return;
+
+    {
+        QMutexLocker locker(&ringMutex);
+        ring = QVector<BufferedMessage>(capacity);
+        ringNext = 0;
+        ringCount = 0;
+    }
+
+    QtMessageHandler previous = qInstallMessageHandler(ringHandler);
+    if (previous != ringHandler) {
+        previousHandler = previous;
+    }
+    QLoggingCategory::setFilterRules("flipbook.*.debug=true");
+}
+
+void flushRingBuffer()
+{
+    QVector<BufferedMessage> messages;
+    {
+        QMutexLocker locker(&ringMutex);
+        if (ringCount == 0) return;
+
+        messages.reserve(ringCount);
+        int first = (ringNext - ringCount + ring.size()) % ring.size();
+        for (int i = 0; i < ringCount; ++i) {
+            messages.append(ring[(first + i) % ring.size()]);
+        }
+        ringCount = 0;
+    }
+
+    // Выводим вне блокировки: обработчик может сам писать в лог
+    for (const BufferedMessage &buffered : messages) {
+        forward(buffered.type, QMessageLogContext(nullptr, 0, nullptr, buffered.category), buffered.message);
+    }
+}
+
+}
@@ -0,0 +1,26 @@
+#ifndef LOGGING_H
+#define LOGGING_H
+
+#include <QLoggingCategory>
+
+// Категории логирования. Отладочные сообщения по умолчанию выключены,
+// поэтому на пути навигации они стоят одну проверку флага. При сборке
+// с FLIPBOOK_DEBUG_LOGGING=OFF qCDebug вырезается компилятором целиком
+Q_DECLARE_LOGGING_CATEGORY(lcLayout)      // flipbook.layout - размеры окна, кнопки
+Q_DECLARE_LOGGING_CATEGORY(lcNavigation)  // flipbook.navigation - переходы между шагами
+Q_DECLARE_LOGGING_CATEGORY(lcResources)   // flipbook.resources - изображения и подписи
+Q_DECLARE_LOGGING_CATEGORY(lcNotes)       // flipbook.notes - замечания
+Q_DECLARE_LOGGING_CATEGORY(lcExport)      // flipbook.export - экспорт PDF/PNG
+Q_DECLARE_LOGGING_CATEGORY(lcPerf)        // flipbook.perf - время стадий загрузки изображений
+
+namespace Logging {
+
+// Включает отладочные категории flipbook.* и складывает их debug-сообщения в
+// кольцевой буфер на capacity строк вместо вывода; info и выше выводятся сразу. Буфер выводится
+// целиком перед первым предупреждением/ошибкой или по flushRingBuffer()
+void installRingBuffer(int capacity);
+void flushRingBuffer();
+
+}
+
+#endif // LOGGING_H
@@ -1,9 +1,74 @@
 #include "mainwindow.h"
+#include "bookexporter.h"
+#include "bookpaths.h"
+#include "logging.h"
+#include "sessionsnapshot.h"
 #include <QApplication>
+#include <QCommandLineParser>
 
 int main(int argc, char *argv[]) {
+    // Экспорт без окна: если платформа не задана явно, работаем через offscreen
+    for (int i = 1; i < argc; ++i) {
+        if (qstrcmp(argv[i], "--export") == 0 || qstrncmp(argv[i], "--export=", 9) == 0) {
+            if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+                qputenv("QT_QPA_PLATFORM", "offscreen");
+            }
+            break;
+        }
+    }
+
     QApplication a(argc, argv);
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption stableLayoutOption("stable-layout",
+                                          "Подобрать окно один раз под все шаги и вписывать изображения в него");
+    QCommandLineOption exportOption("export",
+                                    "Экспортировать инструкцию в PDF или PNG листы (по расширению файла) и выйти",
+                                    "file");
+    QCommandLineOption stepsPerPageOption("steps-per-page",
+                                          "Количество шагов на странице экспорта (по умолчанию 4)",
+                                          "count", "4");
+    QCommandLineOption logRingOption("log-ring",
+                                      "Писать отладочный лог в кольцевой буфер на N строк; буфер выводится "
+                                      "при ошибке или по Ctrl+Shift+L (также FLIPBOOK_LOG_RING)",
+                                      "lines");
+    QCommandLineOption noResumeOption("no-resume",
+                                      "Начать с приветственного экрана, не восстанавливая прошлую сессию");
+    parser.addOption(stableLayoutOption);
+    parser.addOption(noResumeOption);
+    parser.addOption(exportOption);
+    parser.addOption(stepsPerPageOption);
+    parser.addOption(logRingOption);
+    parser.process(a);
+
+    int logRing = parser.isSet(logRingOption) ? parser.value(logRingOption).toInt()
+                                              : qEnvironmentVariableIntValue("FLIPBOOK_LOG_RING");
+    if (logRing > 0) {
+        Logging::installRingBuffer(logRing);
+    }
+
+    if (parser.isSet(exportOption)) {
+        const QString filePath = parser.value(exportOption);
+
+        BookExporter exporter(BookPaths::findImagePaths());
+        exporter.setStepsPerPage(parser.value(stepsPerPageOption).toInt());
+
+        bool ok = exporter.exportTo(filePath, BookExporter::formatForFile(filePath));
+        if (!ok) {
+            qCCritical(lcExport) << "Export failed:" << exporter.errorString();
+            return 1;
+        }
+        qCInfo(lcExport) << "Exported" << exporter.pageCount() << "pages to" << filePath;
+        return 0;
+    }
+
+    if (parser.isSet(noResumeOption)) {
+        SessionSnapshot::discard();
+    }
+
     MainWindow w;
+    w.setStableLayout(parser.isSet(stableLayoutOption));
     w.show();
 
     return a.exec();
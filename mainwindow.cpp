@@ -1,20 +1,28 @@
 #include "mainwindow.h"
+#include "bookpaths.h"
 #include "notesdialog.h"
+#include "bookexporter.h"
+#include "logging.h"
+#include "sessionsnapshot.h"
+#include "stepsource.h"
 
 #include <QLabel>
 #include <QPushButton>
 #include <QVBoxLayout>
 #include <QHBoxLayout>
-#include <QDir>
 #include <QFileInfo>
 #include <QImage>
 #include <QApplication>
-#include <QDebug>
 #include <QScreen>
 #include <QResizeEvent>
+#include <QCloseEvent>
 #include <QTimer>
 #include <QScrollArea>
 #include <QScrollBar>
+#include <QShortcut>
+#include <QFileDialog>
+#include <QProgressDialog>
+#include <QMessageBox>
 
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
@@ -22,6 +30,11 @@ MainWindow::MainWindow(QWidget *parent)
     , m_isWelcomeScreen(true)
     , m_progressWidget(nullptr)
     , m_progressLayout(nullptr)
+    , m_highlightedIndex(-1)
+    , m_stableLayout(false)
+    , m_stableWindowApplied(false)
+    , m_geometryRestored(false)
+    , m_highlightChanges(false)
 {
     setWindowTitle("Инструкция по сборке");
 
@@ -37,23 +50,22 @@ MainWindow::MainWindow(QWidget *parent)
         move(x, y);
     }
 
-    // Загружаем список изображений из папки resources
-    QDir resourcesDir(QApplication::applicationDirPath() + "/resources");
-    if (!resourcesDir.exists()) {
-        qDebug() << "Resources directory does not exist!";
-        // Создаем папку для демонстрации
-        resourcesDir.mkpath(".");
+    // Список шагов берем из снимка прошлой сессии, если он актуален,
+    // иначе сканируем папку resources
+    SessionSnapshot session;
+    bool resumed = session.load(SessionSnapshot::defaultPath())
+                   && session.resourcesDir == BookPaths::resourcesPath() && session.matchesDisk();
+    if (resumed) {
+        m_imagePaths = session.imagePaths();
+    } else {
+        m_imagePaths = BookPaths::findImagePaths();
     }
 
-    QStringList imageFilters = {"*.png", "*.jpg", "*.jpeg", "*.bmp"};
-    m_imagePaths = resourcesDir.entryList(imageFilters, QDir::Files);
-
-    for (QString &path : m_imagePaths) {
-        path = "resources/" + path;
+    // Прогретые миниатюры годятся и после пересканирования - для неизменившихся файлов
+    if (!session.thumbnailFile.isEmpty()) {
+        int restored = m_imageStore.restoreWarmEntries(SessionSnapshot::loadWarmEntries(session.thumbnailFile));
+        qCDebug(lcResources) << "Restored" << restored << "warm image entries";
     }
-    m_imagePaths.sort();
-
-    qDebug() << "Found" << m_imagePaths.size() << "images:" << m_imagePaths;
 
     // Создаем центральный виджет
     QWidget *centralWidget = new QWidget(this);
@@ -108,7 +120,7 @@ MainWindow::MainWindow(QWidget *parent)
     m_progressWidget->hide();
 
     // 2. Создаем imageLabel
-    m_imageLabel = new QLabel(centralWidget);
+    m_imageLabel = new ImageView(centralWidget);
     m_imageLabel->setAlignment(Qt::AlignCenter);
     m_imageLabel->setSizePolicy(QSizePolicy::Expanding, QSizePolicy::Expanding);
     m_imageLabel->setStyleSheet("border: 2px solid #cccccc; background-color: #f8f8f8;");
@@ -147,7 +159,7 @@ MainWindow::MainWindow(QWidget *parent)
     m_nextButton->setFixedSize(70, 70);
 
     // 4. Создаем infoLabel
-    m_infoLabel = new QLabel(centralWidget);
+    m_infoLabel = new CaptionView(centralWidget);
     m_infoLabel->setAlignment(Qt::AlignCenter);
     m_infoLabel->setWordWrap(true);
     m_infoLabel->setStyleSheet("font-size: 14pt; font-weight: bold; padding: 8px; background-color: #f0f0f0;");
@@ -160,10 +172,30 @@ MainWindow::MainWindow(QWidget *parent)
     m_notesButton->setCursor(Qt::PointingHandCursor);
     m_notesButton->setFixedHeight(35);
 
+    // 6. Создаем кнопку экспорта
+    m_exportButton = new QPushButton("📄 Экспорт", centralWidget);
+    m_exportButton->setStyleSheet("font-size: 11pt; padding: 8px; background-color: #607D8B; color: white; border: none; border-radius: 5px;");
+    m_exportButton->setCursor(Qt::PointingHandCursor);
+    m_exportButton->setFixedHeight(35);
+    m_exportButton->setEnabled(!m_imagePaths.isEmpty());
+
+    // 7. Создаем переключатель подсветки изменений
+    m_diffButton = new QPushButton("🔍 Изменения", centralWidget);
+    m_diffButton->setStyleSheet("QPushButton { font-size: 11pt; padding: 8px; background-color: #009688; color: white; border: none; border-radius: 5px; }"
+                                "QPushButton:checked { background-color: #FF5722; }");
+    m_diffButton->setCursor(Qt::PointingHandCursor);
+    m_diffButton->setFixedHeight(35);
+    m_diffButton->setCheckable(true);
+    m_diffButton->setToolTip("Подсветить, что изменилось по сравнению с предыдущим шагом (D)");
+    m_diffButton->setShortcut(QKeySequence("D"));
+    m_diffButton->setEnabled(m_imagePaths.size() > 1);
+
     // Layout для кнопки замечаний
     QHBoxLayout *notesLayout = new QHBoxLayout();
     notesLayout->addStretch();
     notesLayout->addWidget(m_notesButton);
+    notesLayout->addWidget(m_exportButton);
+    notesLayout->addWidget(m_diffButton);
     notesLayout->addStretch();
 
     // Собираем основной layout
@@ -182,8 +214,21 @@ MainWindow::MainWindow(QWidget *parent)
     // Подключаем сигналы
     connect(m_nextButton, &QPushButton::clicked, this, &MainWindow::showNextImage);
     connect(m_prevButton, &QPushButton::clicked, this, &MainWindow::showPrevImage);
+    // Сброс буфера логов по запросу (см. --log-ring)
+    QShortcut *flushLogShortcut = new QShortcut(QKeySequence("Ctrl+Shift+L"), this);
+    connect(flushLogShortcut, &QShortcut::activated, this, [] { Logging::flushRingBuffer(); });
     // Подключаем сигнал кнопки
     connect(m_notesButton, &QPushButton::clicked, this, &MainWindow::showNotesDialog);
+    connect(m_exportButton, &QPushButton::clicked, this, &MainWindow::exportBook);
+    connect(m_diffButton, &QPushButton::toggled, this, &MainWindow::setHighlightChanges);
+    connect(&m_stepDiff, &StepDiff::regionsReady, this, &MainWindow::onDiffReady);
+    // Изображения и миниатюры приходят из рабочих потоков хранилища
+    connect(&m_imageStore, &ImageStore::imageReady, this, &MainWindow::onImageReady);
+    connect(&m_imageStore, &ImageStore::thumbnailReady, this, &MainWindow::onThumbnailReady);
+    // Значки замечаний на миниатюрах берутся из индекса, файлы при навигации не читаются
+    connect(&m_notesIndex, &NotesIndex::built, this, &MainWindow::updateAllNoteBadges);
+    connect(&m_notesIndex, &NotesIndex::countChanged, this, &MainWindow::updateNoteBadge);
+    m_notesIndex.build(m_imagePaths.size());
 
     // Сначала скрываем кнопку замечаний
     m_notesButton->hide();
@@ -193,10 +238,57 @@ MainWindow::MainWindow(QWidget *parent)
 
     // 9. Обновляем позиции кнопок
     QTimer::singleShot(100, this, &MainWindow::updateButtonPositions);
+
+    // 10. Возвращаемся к шагу, на котором остановились
+    if (resumed && session.currentStep >= 0 && session.currentStep < m_imagePaths.size()) {
+        m_isWelcomeScreen = false;
+        m_currentIndex = session.currentStep;
+        // Геометрию применим, когда придет изображение и окно получит свой размер
+        m_pendingGeometry = session.windowGeometry;
+        updateImage();
+
+        m_prevButton->setEnabled(m_currentIndex > 0);
+        m_nextButton->setEnabled(m_currentIndex < m_imagePaths.size() - 1);
+        qCDebug(lcNavigation) << "Resumed session at step" << m_currentIndex + 1;
+    }
 }
 
 MainWindow::~MainWindow() { }
 
+void MainWindow::closeEvent(QCloseEvent *event)
+{
+    saveSession();
+    QMainWindow::closeEvent(event);
+}
+
+void MainWindow::saveSession()
+{
+    SessionSnapshot session;
+    session.currentStep = m_isWelcomeScreen ? -1 : m_currentIndex;
+    session.windowGeometry = saveGeometry();
+    session.setSteps(m_imagePaths, BookPaths::resourcesPath());
+    session.thumbnailFile = SessionSnapshot::defaultThumbnailPath();
+
+    if (!SessionSnapshot::saveWarmEntries(session.thumbnailFile, m_imageStore.warmEntries(m_imagePaths))) {
+        session.thumbnailFile.clear();
+    }
+    if (!session.save(SessionSnapshot::defaultPath())) {
+        qCWarning(lcResources) << "Failed to save session snapshot:" << SessionSnapshot::defaultPath();
+    }
+}
+
+void MainWindow::setStableLayout(bool enabled)
+{
+    m_stableLayout = enabled;
+    m_stableWindowApplied = false;
+    m_stableImageSize = QSize();
+
+    // Шаг мог быть уже показан при восстановлении сессии - подбираем окно заново
+    if (!m_isWelcomeScreen) {
+        updateImage();
+    }
+}
+
 void MainWindow::resizeEvent(QResizeEvent *event)
 {
     QMainWindow::resizeEvent(event);
@@ -229,16 +321,17 @@ void MainWindow::updateButtonPositions()
     m_prevButton->raise();
     m_nextButton->raise();
 
-    qDebug() << "Buttons raised to top";
-    qDebug() << "Prev button visible:" << m_prevButton->isVisible();
-    qDebug() << "Next button visible:" << m_nextButton->isVisible();
-    qDebug() << "Prev button enabled:" << m_prevButton->isEnabled();
-    qDebug() << "Next button enabled:" << m_nextButton->isEnabled();
+    qCDebug(lcLayout) << "Buttons placed at" << m_prevButton->pos() << m_nextButton->pos();
 }
 
 void MainWindow::showWelcomeScreen()
 {
     m_isWelcomeScreen = true;
+    m_currentPixmap = QPixmap();
+    m_currentPixmapPath.clear();
+    m_previousPixmap = QPixmap();
+    m_previousPixmapPath.clear();
+    m_diffRequestedPath.clear();
 
     // Очищаем изображение
     m_imageLabel->clear();
@@ -256,11 +349,11 @@ void MainWindow::showWelcomeScreen()
                           "Используйте кнопки навигации для перемещения\n"
                           "между шагами сборки";
 
-    m_imageLabel->setText(welcomeText);
+    m_imageLabel->showMessage(welcomeText);
     m_imageLabel->setAlignment(Qt::AlignCenter);
 
     // Устанавливаем информационный текст
-    m_infoLabel->setText("Готов к работе");
+    m_infoLabel->showMessage("Готов к работе");
 
     // ОБЕСПЕЧИВАЕМ ВИДИМОСТЬ КНОПОК
     m_prevButton->show();
@@ -275,6 +368,11 @@ void MainWindow::showWelcomeScreen()
     // Обновляем позиции кнопок
     updateButtonPositions();
 
+    // В стабильном режиме окно уже подобрано под все шаги - не трогаем его
+    if (m_stableLayout && m_stableWindowApplied) {
+        return;
+    }
+
     // Устанавливаем фиксированный размер окна
     setFixedSize(800, 600);
 
@@ -290,14 +388,24 @@ void MainWindow::showWelcomeScreen()
 
 void MainWindow::updateProgressIndicator()
 {
-    for (int i = 0; i < m_progressLabels.size(); ++i) {
-        if (i == m_currentIndex) {
-            // Выделяем текущее изображение
-            m_progressLabels[i]->setStyleSheet("border: 3px solid #2196F3; background-color: #e3f2fd;");
-        } else {
-            // Обычный стиль для остальных
-            m_progressLabels[i]->setStyleSheet("border: 2px solid #cccccc; background-color: #ffffff;");
-        }
+    // Меняем стиль только у двух миниатюр: бывшей и новой текущей.
+    // Перестилизация всей полосы на каждом шаге стоит O(N) пересчетов стилей
+    if (m_highlightedIndex == m_currentIndex) {
+        centerCurrentThumbnail();
+        return;
+    }
+
+    if (m_highlightedIndex >= 0 && m_highlightedIndex < m_progressLabels.size()) {
+        // Обычный стиль для остальных
+        m_progressLabels[m_highlightedIndex]->setStyleSheet("border: 2px solid #cccccc; background-color: #ffffff;");
+    }
+
+    if (m_currentIndex >= 0 && m_currentIndex < m_progressLabels.size()) {
+        // Выделяем текущее изображение
+        m_progressLabels[m_currentIndex]->setStyleSheet("border: 3px solid #2196F3; background-color: #e3f2fd;");
+        m_highlightedIndex = m_currentIndex;
+    } else {
+        m_highlightedIndex = -1;
     }
 
     // Центрируем текущую миниатюру
@@ -307,7 +415,7 @@ void MainWindow::updateProgressIndicator()
 void MainWindow::showNextImage()
 {
     if (m_imagePaths.isEmpty()) {
-        qDebug() << "No images available";
+        qCDebug(lcNavigation) << "No images available";
         return;
     }
 
@@ -324,9 +432,6 @@ void MainWindow::showNextImage()
         updateImage();
     }
 
-    // Обновляем индикатор прогресса
-    updateProgressIndicator();
-
     // Обновляем состояние кнопок
     m_prevButton->setEnabled(m_currentIndex > 0);
     m_nextButton->setEnabled(m_currentIndex < m_imagePaths.size() - 1);
@@ -335,7 +440,7 @@ void MainWindow::showNextImage()
 void MainWindow::showPrevImage()
 {
     if (m_imagePaths.isEmpty()) {
-        qDebug() << "No images available";
+        qCDebug(lcNavigation) << "No images available";
         return;
     }
 
@@ -350,9 +455,6 @@ void MainWindow::showPrevImage()
         updateImage();
     }
 
-    // Обновляем индикатор прогресса
-    updateProgressIndicator();
-
     // Обновляем состояние кнопок
     m_prevButton->setEnabled(m_currentIndex > 0);
     m_nextButton->setEnabled(m_currentIndex < m_imagePaths.size() - 1);
@@ -361,39 +463,27 @@ void MainWindow::showPrevImage()
 void MainWindow::updateImage()
 {
     if (m_imagePaths.isEmpty()) {
-        m_imageLabel->setText("Нет изображений для отображения\nДобавьте изображения в папку resources");
-        m_infoLabel->setText("Папка resources пуста");
+        m_imageLabel->showMessage("Нет изображений для отображения\nДобавьте изображения в папку resources");
+        m_infoLabel->showMessage("Папка resources пуста");
         m_progressWidget->hide(); // Скрываем индикатор если нет изображений
         return;
     }
 
     if (m_currentIndex < 0 || m_currentIndex >= m_imagePaths.size()) {
-        m_imageLabel->setText("Ошибка: неверный индекс изображения");
-        m_infoLabel->setText("Ошибка загрузки");
+        m_imageLabel->showMessage("Ошибка: неверный индекс изображения");
+        m_infoLabel->showMessage("Ошибка загрузки");
         return;
     }
 
     // ПОКАЗЫВАЕМ индикатор прогресса для изображений
     m_progressWidget->show();
-    createProgressIndicator(); // Обновляем индикатор
-
-    QString imagePath = m_imagePaths[m_currentIndex];
-
-    // Загружаем изображение
-    m_currentPixmap = QPixmap(imagePath);
-
-    if (m_currentPixmap.isNull()) {
-        m_imageLabel->setText("Не удалось загрузить изображение:\n" + imagePath);
-        m_infoLabel->setText("Ошибка загрузки файла");
-        return;
+    if (m_progressLabels.size() != m_imagePaths.size()) {
+        createProgressIndicator(); // Миниатюры строим один раз
+    } else {
+        updateProgressIndicator(); // Дальше только переключаем выделение
     }
 
-    // Восстанавливаем стандартный стиль
-    m_imageLabel->setStyleSheet("border: 2px solid #cccccc; background-color: #f8f8f8;");
-
-    // Отображаем изображение
-    m_imageLabel->setPixmap(m_currentPixmap);
-    m_imageLabel->setAlignment(Qt::AlignCenter);
+    QString imagePath = m_imagePaths[m_currentIndex];
 
     // ОБЕСПЕЧИВАЕМ ВИДИМОСТЬ КНОПОК
     m_prevButton->show();
@@ -404,14 +494,219 @@ void MainWindow::updateImage()
     // Показываем кнопку замечаний только для изображений
     m_notesButton->setVisible(!m_isWelcomeScreen);
 
-    // Обновляем информацию о размере
-    m_infoLabel->setText(getImageSizeText(imagePath));
+    // Обновляем подпись: разобранный и сверстанный документ берется из кэша,
+    // файл подписи читается заново, только если изменился его mtime
+    const QString captionPath = BookPaths::captionFilePath(imagePath);
+    const QDateTime captionModified = captionPath.isEmpty() ? QDateTime()
+                                                            : StepSource::stat(captionPath).modified;
+    if (!m_infoLabel->showCaption(m_currentIndex, captionModified)) {
+        CaptionView::Format format = CaptionView::PlainText;
+        QString caption = getImageSizeText(imagePath, &format);
+        m_infoLabel->setCaption(m_currentIndex, caption, format, captionModified);
+    }
+
+    // Изображение декодируется и готовится к отрисовке в рабочих потоках
+    // (одинаковые файлы - один раз); из кэша onImageReady вызывается сразу
+    if (m_currentPixmap.isNull()) {
+        m_imageLabel->showMessage("Загрузка...");
+    }
+    m_imageStore.requestImage(imagePath, imageFitSize());
+
+    // Соседние шаги готовим заранее, чтобы переход на них был только отрисовкой
+    for (int neighbour : {m_currentIndex + 1, m_currentIndex - 1}) {
+        if (neighbour >= 0 && neighbour < m_imagePaths.size()) {
+            m_imageStore.requestImage(m_imagePaths[neighbour], imageFitSize());
+        }
+    }
+}
+
+QSize MainWindow::imageFitSize() const
+{
+    return m_stableLayout ? m_stableImageSize : QSize();
+}
+
+void MainWindow::onImageReady(const QString &path, const QSize &fitTo, const QPixmap &pixmap)
+{
+    if (path == m_diffRequestedPath) {
+        m_diffRequestedPath.clear();
+    }
+
+    // Соседний шаг из предзагрузки или устаревший запрос - он уже в кэше хранилища
+    if (m_isWelcomeScreen || m_currentIndex < 0 || m_currentIndex >= m_imagePaths.size()) return;
+    if (fitTo != imageFitSize()) return;
+
+    // Предыдущий шаг нужен для подсветки изменений (не загрузился - подсвечивать нечего)
+    if (m_highlightChanges && m_currentIndex > 0 && path == m_imagePaths[m_currentIndex - 1]) {
+        if (pixmap.isNull()) return;
+        m_previousPixmap = pixmap;
+        m_previousPixmapPath = path;
+        m_previousFitTo = fitTo;
+        updateChangeHighlights();
+        return;
+    }
+    if (path != m_imagePaths[m_currentIndex]) return;
+
+    showPixmap(path, pixmap);
+}
+
+void MainWindow::showPixmap(const QString &imagePath, const QPixmap &pixmap)
+{
+    // Шаг вперед: показанное изображение становится предыдущим для подсветки
+    if (!m_currentPixmap.isNull() && m_currentIndex > 0
+        && m_currentPixmapPath == m_imagePaths[m_currentIndex - 1]) {
+        m_previousPixmap = m_currentPixmap;
+        m_previousPixmapPath = m_currentPixmapPath;
+        m_previousFitTo = imageFitSize();
+    }
+
+    m_currentPixmap = pixmap;
+    m_currentPixmapPath = imagePath;
+
+    if (m_currentPixmap.isNull()) {
+        m_imageLabel->showMessage("Не удалось загрузить изображение:\n" + imagePath);
+        m_infoLabel->showMessage("Ошибка загрузки файла");
+        return;
+    }
+
+    // Восстанавливаем стандартный стиль (повторная установка стиля вызывает repolish)
+    const QString imageStyle = "border: 2px solid #cccccc; background-color: #f8f8f8;";
+    if (m_imageLabel->styleSheet() != imageStyle) {
+        m_imageLabel->setStyleSheet(imageStyle);
+    }
+
+    // Отображаем изображение (в стабильном режиме - вписанным в общую область)
+    m_imageLabel->setFitSize(imageFitSize());
+    m_imageLabel->setImage(m_currentPixmap);
+    m_imageLabel->setAlignment(Qt::AlignCenter);
 
     // Меняем размер окна под изображение
     updateWindowSize();
 
+    // Положение окна из прошлой сессии - после всех перестроений окна под
+    // изображение (setStableLayout() показывает шаг еще раз)
+    if (!m_pendingGeometry.isEmpty()) {
+        QTimer::singleShot(0, this, &MainWindow::applyPendingGeometry);
+    }
+
     // Обновляем позиции кнопок
     updateButtonPositions();
+
+    updateChangeHighlights();
+}
+
+void MainWindow::applyPendingGeometry()
+{
+    if (m_pendingGeometry.isEmpty()) return;
+
+    restoreGeometry(m_pendingGeometry);
+    m_pendingGeometry.clear();
+    m_geometryRestored = true;
+    keepOnScreen();
+    qCDebug(lcLayout) << "Window geometry restored:" << geometry();
+}
+
+void MainWindow::keepOnScreen()
+{
+    // Окно меняет размер от своего левого верхнего угла - большой шаг мог
+    // вытолкнуть его за край экрана, сдвигаем обратно
+    QScreen *screen = this->screen();
+    if (!screen) return;
+
+    const QRect available = screen->availableGeometry();
+    const QRect frame = frameGeometry();
+    const int x = qBound(available.left(), frame.left(), qMax(available.left(), available.right() - frame.width() + 1));
+    const int y = qBound(available.top(), frame.top(), qMax(available.top(), available.bottom() - frame.height() + 1));
+    if (x != frame.left() || y != frame.top()) {
+        move(x, y);
+    }
+}
+
+void MainWindow::setHighlightChanges(bool enabled)
+{
+    m_highlightChanges = enabled;
+    updateChangeHighlights();
+}
+
+void MainWindow::updateChangeHighlights()
+{
+    m_diffKey.clear();
+    if (!m_highlightChanges || m_isWelcomeScreen || m_currentIndex <= 0
+        || m_currentIndex >= m_imagePaths.size() || m_currentPixmap.isNull()) {
+        m_imageLabel->setHighlights({});
+        return;
+    }
+
+    const QString previousPath = m_imagePaths[m_currentIndex - 1];
+    const QString currentPath = m_imagePaths[m_currentIndex];
+
+    // При смене шага на экране еще прежнее изображение - сравним, когда придет новое
+    if (m_currentPixmapPath != currentPath) {
+        m_imageLabel->setHighlights({});
+        return;
+    }
+
+    // Ключ пары - по содержимому: одинаковые пары файлов сравниваются один раз.
+    // Хэш в GUI-потоке не считаем: если ключа еще нет, хранилище посчитает его
+    // в рабочем потоке вместе с изображением, и мы вернемся сюда из onImageReady
+    const QSize fitTo = imageFitSize();
+    const QByteArray previousKey = m_imageStore.knownContentKey(previousPath);
+    const QByteArray currentKey = m_imageStore.knownContentKey(currentPath);
+    if (previousKey.isEmpty() || currentKey.isEmpty()) {
+        m_imageLabel->setHighlights({});
+        requestForDiff(previousKey.isEmpty() ? previousPath : currentPath);
+        return;
+    }
+    const QByteArray pairKey = previousKey + currentKey
+                               + QByteArray::number(fitTo.width()) + 'x' + QByteArray::number(fitTo.height());
+
+    QVector<QRect> regions;
+    if (m_stepDiff.cached(pairKey, &regions)) {
+        m_imageLabel->setHighlights(regions);
+        return;
+    }
+
+    // Предыдущий шаг обычно уже предзагружен или был показан; если нет -
+    // вернемся сюда из onImageReady
+    m_diffKey = pairKey;
+    QPixmap previous = m_imageStore.cachedPixmap(previousPath, fitTo);
+    if (previous.isNull() && m_previousPixmapPath == previousPath && m_previousFitTo == fitTo) {
+        previous = m_previousPixmap;
+    }
+    if (previous.isNull()) {
+        requestForDiff(previousPath);
+        return;
+    }
+    m_stepDiff.request(pairKey, previous.toImage(), m_currentPixmap.toImage());
+}
+
+void MainWindow::requestForDiff(const QString &path)
+{
+    // Повторно не запрашиваем: ответ на прежний запрос еще не пришел
+    if (m_diffRequestedPath == path) return;
+    m_diffRequestedPath = path;
+    m_imageStore.requestImage(path, imageFitSize());
+}
+
+void MainWindow::onDiffReady(const QByteArray &pairKey, const QVector<QRect> &regions)
+{
+    // Пока считали, пользователь мог перейти на другой шаг
+    if (pairKey != m_diffKey) return;
+
+    qCDebug(lcNavigation) << "Step" << m_currentIndex + 1 << "changed regions:" << regions.size();
+    m_imageLabel->setHighlights(regions);
+}
+
+void MainWindow::onThumbnailReady(const QString &path, const QPixmap &thumbnail)
+{
+    int index = m_stepIndex.value(path, -1);
+    if (index < 0 || index >= m_progressLabels.size()) return;
+
+    QLabel *thumbLabel = m_progressLabels[index];
+    if (!thumbnail.isNull()) {
+        thumbLabel->setPixmap(thumbnail);
+    } else if (index != m_highlightedIndex) {
+        thumbLabel->setStyleSheet("border: 2px solid #cccccc; background-color: #f8f8f8; font-weight: bold;");
+    }
 }
 
 void MainWindow::updateWindowSize()
@@ -420,6 +715,11 @@ void MainWindow::updateWindowSize()
         return;
     }
 
+    // В стабильном режиме окно подбирается один раз, дальше шаг - только перерисовка
+    if (m_stableLayout && m_stableWindowApplied) {
+        return;
+    }
+
     // Снимаем фиксированный размер
     setMinimumSize(0, 0);
     setMaximumSize(QWIDGETSIZE_MAX, QWIDGETSIZE_MAX);
@@ -428,27 +728,35 @@ void MainWindow::updateWindowSize()
     int imageWidth = m_currentPixmap.width();
     int imageHeight = m_currentPixmap.height();
 
-    // Рассчитываем и добавляем отступы для информации и индикатора прогресса
-    int infoLabelHeight = m_infoLabel->sizeHint().height();
-    int progressHeight = m_progressWidget->isVisible() ? 60 : 0; // Высота индикатора
-    int layoutSpacing = centralWidget()->layout()->spacing();
-    int layoutMargins = centralWidget()->layout()->contentsMargins().bottom();
-
-    int windowWidth = imageWidth;
-    int windowHeight = imageHeight + infoLabelHeight + progressHeight + layoutSpacing + layoutMargins;
+    // В стабильном режиме высота подписи меняется от шага к шагу, поэтому резервируем максимум
+    int infoLabelHeight = m_stableLayout ? m_infoLabel->maximumHeight()
+                                         : m_infoLabel->sizeHint().height();
+    QSize windowSize;
 
-    // Устанавливаем минимальные размеры
-    windowWidth = qMax(windowWidth, 400);
-    windowHeight = qMax(windowHeight, 300);
+    if (m_stableLayout) {
+        QSize bounding = boundingImageSize();
+        if (!bounding.isValid()) {
+            bounding = m_currentPixmap.size();
+        }
 
-    // Устанавливаем максимальные размеры
-    QScreen *primaryScreen = QApplication::primaryScreen();
-    if (primaryScreen) {
-        QSize screenSize = primaryScreen->availableSize();
-        windowWidth = qMin(windowWidth, static_cast<int>(screenSize.width() * 0.9));
-        windowHeight = qMin(windowHeight, static_cast<int>(screenSize.height() * 0.9));
+        // Область под изображение - то, что осталось от окна после подписи, индикатора,
+        // кнопки замечаний и рамки imageLabel; урезается, только если окно уперлось в экран
+        windowSize = windowSizeForImage(bounding);
+        const QSize reserved = stableImageChrome();
+        m_stableImageSize = QSize(qMax(windowSize.width() - reserved.width(), 1),
+                                  qMax(windowSize.height() - chromeHeight() - reserved.height(), 1))
+                                .boundedTo(bounding);
+        m_stableWindowApplied = true;
+
+        // Текущее изображение уже показано - вписываем его в итоговую область
+        m_imageLabel->setFitSize(m_stableImageSize);
+    } else {
+        windowSize = windowSizeForImage(m_currentPixmap.size());
     }
 
+    int windowWidth = windowSize.width();
+    int windowHeight = windowSize.height();
+
     // Меняем размер окна
     //resize(windowWidth, windowHeight);
 
@@ -464,40 +772,114 @@ void MainWindow::updateWindowSize()
     // Центрируем текущую миниатюру после изменения размера
     QTimer::singleShot(100, this, &MainWindow::centerCurrentThumbnail);
 
-    // ЯВНО ЗАДАЕМ ГЕОМЕТРИЮ INFO LABEL
-    QRect imageRect = m_imageLabel->geometry();
-    int infoY = imageRect.y() + imageRect.height() + 5; // 5px отступ
-    m_infoLabel->setGeometry(0, infoY, windowWidth, infoLabelHeight);
+    // ЯВНО ЗАДАЕМ ГЕОМЕТРИЮ INFO LABEL (в стабильном режиме этим занимается layout)
+    if (!m_stableLayout) {
+        QRect imageRect = m_imageLabel->geometry();
+        int infoY = imageRect.y() + imageRect.height() + 5; // 5px отступ
+        m_infoLabel->setGeometry(0, infoY, windowWidth, infoLabelHeight);
+    }
 
     // Обновляем позиции кнопок после изменения размера
     updateButtonPositions();
 
-    // Центрируем окно на экране
+    // Центрируем окно на экране. Если положение восстановлено из прошлой сессии,
+    // оставляем окно на месте и только не даем ему уйти за край экрана
     QScreen *screen = QApplication::primaryScreen();
-    if (screen) {
+    if (m_geometryRestored) {
+        keepOnScreen();
+    } else if (screen) {
         QRect screenGeometry = screen->availableGeometry();
         int x = (screenGeometry.width() - windowWidth) / 2;
         int y = (screenGeometry.height() - windowHeight) / 2;
         move(x, y);
     }
 
-    qDebug() << "Window resized to:" << windowWidth << "x" << windowHeight;
-    qDebug() << "Image:" << imageWidth << "x" << imageHeight;
-    qDebug() << "Info label geometry:" << m_infoLabel->geometry();
+    qCDebug(lcLayout) << "Window resized to:" << windowWidth << "x" << windowHeight
+                      << "image:" << imageWidth << "x" << imageHeight;
 }
 
-QString MainWindow::getImageSizeText(const QString &imagePath) const
+int MainWindow::chromeHeight() const
 {
-    QImage image(imagePath);
+    // Рассчитываем отступы для информации и индикатора прогресса
+    int infoLabelHeight = m_stableLayout ? m_infoLabel->maximumHeight()
+                                         : m_infoLabel->sizeHint().height();
+    int progressHeight = m_progressWidget->isVisible() ? 60 : 0; // Высота индикатора
+
+    // Промежутки и поля считаем по самому layout: скрытые элементы
+    // (индикатор прогресса) промежутка не получают
+    const QLayout *layout = centralWidget()->layout();
+    int visibleItems = 0;
+    for (int i = 0; i < layout->count(); ++i) {
+        if (!layout->itemAt(i)->isEmpty()) ++visibleItems;
+    }
+    int layoutSpacing = layout->spacing() * qMax(visibleItems - 1, 0);
+    QMargins margins = layout->contentsMargins();
+
+    return infoLabelHeight + progressHeight + layoutSpacing + margins.top() + margins.bottom();
+}
 
-    if (image.isNull()) {
+QSize MainWindow::stableImageChrome() const
+{
+    // Рамка imageLabel (2px с каждой стороны) и строка с кнопкой замечаний,
+    // промежутки layout уже учтены в chromeHeight()
+    return QSize(4, m_notesButton->height() + 4);
+}
+
+QSize MainWindow::windowSizeForImage(const QSize &imageSize) const
+{
+    int windowWidth = imageSize.width();
+    int windowHeight = imageSize.height() + chromeHeight();
+
+    // В стабильном режиме область изображения считается без рамки и кнопок - добавляем их
+    if (m_stableLayout) {
+        windowWidth += stableImageChrome().width();
+        windowHeight += stableImageChrome().height();
+    }
+
+    // Устанавливаем минимальные размеры
+    windowWidth = qMax(windowWidth, 400);
+    windowHeight = qMax(windowHeight, 300);
+
+    // Устанавливаем максимальные размеры
+    QScreen *primaryScreen = QApplication::primaryScreen();
+    if (primaryScreen) {
+        QSize screenSize = primaryScreen->availableSize();
+        windowWidth = qMin(windowWidth, static_cast<int>(screenSize.width() * 0.9));
+        windowHeight = qMin(windowHeight, static_cast<int>(screenSize.height() * 0.9));
+    }
+
+    return QSize(windowWidth, windowHeight);
+}
+
+QSize MainWindow::boundingImageSize()
+{
+    // Размеры берем из заголовков файлов, без декодирования пикселей
+    QSize bounding;
+    for (const QString &path : m_imagePaths) {
+        QSize size = m_imageStore.imageSize(path);
+        if (size.isValid()) {
+            bounding = bounding.expandedTo(size);
+        }
+    }
+    return bounding;
+}
+
+QString MainWindow::getImageSizeText(const QString &imagePath, CaptionView::Format *format)
+{
+    if (format) {
+        *format = CaptionView::PlainText;
+    }
+
+    // Размер - из общей записи хранилища, без повторного декодирования
+    QSize imageSize = m_imageStore.imageSize(imagePath);
+
+    if (!imageSize.isValid()) {
         return QString("Ошибка загрузки изображения: %1").arg(QFileInfo(imagePath).fileName());
     }
 
     // Загружаем текст из соответствующего .txt файла
     QFileInfo imageInfo(imagePath);
-    QString textFilePath = imageInfo.absolutePath() + "/" + imageInfo.completeBaseName() + ".txt";
-    QString descriptionText = loadTextFromFile(textFilePath);
+    QString descriptionText = BookPaths::loadCaption(imagePath, format);
 
     if (!descriptionText.isEmpty()) {
         // Если есть текстовый файл, показываем его содержимое
@@ -508,44 +890,55 @@ QString MainWindow::getImageSizeText(const QString &imagePath) const
             .arg(m_currentIndex + 1)
             .arg(m_imagePaths.size())
             .arg(imageInfo.fileName())
-            .arg(image.width())
-            .arg(image.height());
+            .arg(imageSize.width())
+            .arg(imageSize.height());
     }
 }
 
-QString MainWindow::loadTextFromFile(const QString &filePath) const
+void MainWindow::showNotesDialog()
 {
-    QFile file(filePath);
-    if (!file.exists()) {
-        qDebug() << "Text file not found:" << filePath;
-        return "";
+    if (m_isWelcomeScreen || m_currentIndex < 0) return;
+
+    NotesDialog dialog(m_currentIndex, this);
+    connect(&dialog, &NotesDialog::notesCountChanged, &m_notesIndex, &NotesIndex::update);
+    if (dialog.exec() == QDialog::Accepted) {
+        // Можно обработать результат если нужно
+        qCDebug(lcNotes) << "Notes dialog closed";
     }
+}
 
-    if (file.open(QIODevice::ReadOnly | QIODevice::Text)) {
-        // Читаем файл с автоматическим определением кодировки
-        QTextStream in(&file);
-        QString text = in.readAll();
-        file.close();
+void MainWindow::exportBook()
+{
+    if (m_imagePaths.isEmpty()) return;
 
-        // Убираем лишние переносы строк в начале и конце
-        text = text.trimmed();
+    QString selectedFilter;
+    QString filePath = QFileDialog::getSaveFileName(this, "Экспорт инструкции", "instruction.pdf",
+                                                    "PDF (*.pdf);;PNG листы (*.png)", &selectedFilter);
+    if (filePath.isEmpty()) return;
 
-        qDebug() << "Loaded text from:" << filePath << "Content:" << text.left(50) + "...";
-        return text;
+    if (QFileInfo(filePath).suffix().isEmpty()) {
+        filePath += selectedFilter.startsWith("PNG") ? ".png" : ".pdf";
     }
 
-    qDebug() << "Failed to open text file:" << filePath;
-    return "";
-}
+    BookExporter exporter(m_imagePaths);
+    BookExporter::Format format = BookExporter::formatForFile(filePath);
 
-void MainWindow::showNotesDialog()
-{
-    if (m_isWelcomeScreen || m_currentIndex < 0) return;
+    QProgressDialog progress("Экспорт страниц...", "Отмена", 0, exporter.pageCount(), this);
+    progress.setWindowTitle("Экспорт");
+    progress.setWindowModality(Qt::WindowModal);
+    progress.setMinimumDuration(0);
 
-    NotesDialog dialog(m_currentIndex, this);
-    if (dialog.exec() == QDialog::Accepted) {
-        // Можно обработать результат если нужно
-        qDebug() << "Notes dialog closed";
+    bool ok = exporter.exportTo(filePath, format, [&progress](int done, int total) {
+        progress.setMaximum(total);
+        progress.setValue(done);
+        return !progress.wasCanceled();
+    });
+    progress.reset();
+
+    if (ok) {
+        QMessageBox::information(this, "Экспорт", "Инструкция сохранена:\n" + filePath);
+    } else if (!exporter.errorString().isEmpty()) {
+        QMessageBox::warning(this, "Экспорт", exporter.errorString());
     }
 }
 
@@ -557,6 +950,8 @@ void MainWindow::createProgressIndicator()
         delete label;
     }
     m_progressLabels.clear();
+    m_noteBadges.clear(); // Значки - дочерние миниатюр и удалены вместе с ними
+    m_stepIndex.clear();
 
     // Очищаем layout полностью
     QLayoutItem* item;
@@ -568,20 +963,21 @@ void MainWindow::createProgressIndicator()
     if (m_imagePaths.isEmpty()) return;
 
     // Создаем миниатюры для каждого изображения
+    QStringList pendingThumbnails;
     for (int i = 0; i < m_imagePaths.size(); ++i) {
         QLabel *thumbLabel = new QLabel();
         thumbLabel->setAlignment(Qt::AlignCenter);
         thumbLabel->setFixedSize(50, 40);
         thumbLabel->setStyleSheet("border: 2px solid #cccccc; background-color: #ffffff;");
 
-        // Загружаем миниатюру
-        QPixmap original(m_imagePaths[i]);
-        if (!original.isNull()) {
-            QPixmap thumbnail = original.scaled(40, 30, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+        // Миниатюра общая для одинаковых изображений; если ее еще нет,
+        // показываем номер шага, пока она готовится в рабочем потоке
+        QPixmap thumbnail = m_imageStore.cachedThumbnail(m_imagePaths[i]);
+        if (!thumbnail.isNull()) {
             thumbLabel->setPixmap(thumbnail);
         } else {
             thumbLabel->setText(QString::number(i + 1));
-            thumbLabel->setStyleSheet("border: 2px solid #cccccc; background-color: #f8f8f8; font-weight: bold;");
+            pendingThumbnails << m_imagePaths[i];
         }
 
         // Выделяем текущее изображение
@@ -591,6 +987,14 @@ void MainWindow::createProgressIndicator()
 
         m_progressLayout->addWidget(thumbLabel);
         m_progressLabels.append(thumbLabel);
+        m_stepIndex.insert(m_imagePaths[i], i);
+    }
+    m_highlightedIndex = m_currentIndex;
+    updateAllNoteBadges();
+
+    // Недостающие миниатюры готовятся в рабочих потоках и приходят в onThumbnailReady
+    for (const QString &path : pendingThumbnails) {
+        m_imageStore.requestThumbnail(path);
     }
 
     // Автоматически прокручиваем к текущему изображению
@@ -603,6 +1007,51 @@ void MainWindow::createProgressIndicator()
     //centerCurrentThumbnail();
 }
 
+void MainWindow::updateAllNoteBadges()
+{
+    if (!m_notesIndex.isBuilt()) return;
+
+    for (int step = 0; step < m_progressLabels.size(); ++step) {
+        updateNoteBadge(step);
+    }
+}
+
+void MainWindow::updateNoteBadge(int step)
+{
+    if (step < 0 || step >= m_progressLabels.size()) return;
+
+    const int count = m_notesIndex.count(step);
+    while (m_noteBadges.size() < m_progressLabels.size()) {
+        m_noteBadges.append(nullptr);
+    }
+
+    QLabel *badge = m_noteBadges[step];
+    if (count == 0) {
+        if (badge) badge->hide();
+        return;
+    }
+
+    if (!badge) {
+        // Значок в правом верхнем углу миниатюры 50x40
+        badge = new QLabel(m_progressLabels[step]);
+        badge->setAlignment(Qt::AlignCenter);
+        badge->setStyleSheet("background-color: #FF9800; color: white; border: none; border-radius: 7px; "
+                             "font-size: 7pt; font-weight: bold;");
+        badge->setGeometry(32, 0, 18, 14);
+        m_noteBadges[step] = badge;
+    }
+
+    badge->setText(count > 99 ? "99+" : QString::number(count));
+    QString toolTip = QString("Замечаний: %1").arg(count);
+    const QDateTime modified = m_notesIndex.lastModified(step);
+    if (modified.isValid()) {
+        toolTip += ", изменены " + modified.toString("dd.MM.yyyy hh:mm");
+    }
+    badge->setToolTip(toolTip);
+    badge->show();
+    badge->raise();
+}
+
 void MainWindow::centerCurrentThumbnail()
 {
     if (m_currentIndex < 0 || m_currentIndex >= m_progressLabels.size()) return;
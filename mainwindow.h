@@ -4,6 +4,12 @@
 #include <QMainWindow>
 #include <QHBoxLayout>
 
+#include "captionview.h"
+#include "imagestore.h"
+#include "imageview.h"
+#include "notesindex.h"
+#include "stepdiff.h"
+
 class QLabel;
 class QPushButton;
 
@@ -14,38 +20,82 @@ public:
     MainWindow(QWidget *parent = nullptr);
     ~MainWindow();
 
+    // Режим стабильной раскладки: окно подбирается один раз под самый
+    // большой шаг, остальные изображения вписываются в ту же область
+    void setStableLayout(bool enabled);
+
 private slots:
     void showNextImage();
     void showPrevImage();
     void showNotesDialog();
+    void exportBook();
+    void onImageReady(const QString &path, const QSize &fitTo, const QPixmap &pixmap);
+    void onThumbnailReady(const QString &path, const QPixmap &thumbnail);
+    void updateNoteBadge(int step);
+    void updateAllNoteBadges();
+    void setHighlightChanges(bool enabled);
+    void onDiffReady(const QByteArray &pairKey, const QVector<QRect> &regions);
 
 protected:
     void resizeEvent(QResizeEvent *event) override;
+    void closeEvent(QCloseEvent *event) override;
 
 private:
+    void saveSession();
+    void applyPendingGeometry();
+    void keepOnScreen();
     void showWelcomeScreen();
     void updateImage();
+    void showPixmap(const QString &imagePath, const QPixmap &pixmap);
+    QSize imageFitSize() const;
     void updateWindowSize();
+    int chromeHeight() const;
+    QSize stableImageChrome() const;
+    QSize windowSizeForImage(const QSize &imageSize) const;
+    QSize boundingImageSize();
     void updateButtonPositions();
     void createProgressIndicator();
     void updateProgressIndicator();
-    QString getImageSizeText(const QString &imagePath) const;
-    QString loadTextFromFile(const QString &filePath) const;
+    void updateChangeHighlights();
+    void requestForDiff(const QString &path);
+    QString getImageSizeText(const QString &imagePath, CaptionView::Format *format = nullptr);
 
-    QLabel *m_imageLabel;
-    QLabel *m_infoLabel;
+    ImageView *m_imageLabel;
+    CaptionView *m_infoLabel;
     QPushButton *m_prevButton;
     QPushButton *m_nextButton;
 
     int m_currentIndex;
     QStringList m_imagePaths;
     QPixmap m_currentPixmap;
+    QString m_currentPixmapPath;     // Шаг, чье изображение сейчас в m_currentPixmap
+    QPixmap m_previousPixmap;        // Предыдущий шаг для подсветки изменений: в кэш
+    QString m_previousPixmapPath;    // хранилища очень большое изображение не попадает
+    QSize m_previousFitTo;
+    QString m_diffRequestedPath;     // Уже запрошен для подсветки, ждем onImageReady
+    ImageStore m_imageStore;         // Декодированные изображения, общие для одинаковых файлов
     bool m_isWelcomeScreen;
     QPushButton *m_notesButton;
+    QPushButton *m_exportButton;
+    QPushButton *m_diffButton;
 
     QHBoxLayout *m_progressLayout; // Layout для индикатора прогресса
     QWidget *m_progressWidget;     // Виджет для индикатора
     QList<QLabel*> m_progressLabels; // Миниатюры для прогресса
+    QHash<QString, int> m_stepIndex; // Путь изображения -> номер миниатюры
+    QList<QLabel*> m_noteBadges;     // Значки с числом замечаний на миниатюрах (создаются по надобности)
+    NotesIndex m_notesIndex;         // Число замечаний по шагам
+    int m_highlightedIndex;          // Миниатюра, выделенная в данный момент
+
+    bool m_stableLayout;             // Режим стабильной раскладки
+    bool m_stableWindowApplied;      // Размер окна уже выставлен
+    QSize m_stableImageSize;         // Область под изображение в стабильном режиме
+    QByteArray m_pendingGeometry;    // Геометрия окна из снимка сессии, ждет первого изображения
+    bool m_geometryRestored;         // Положение окна восстановлено - не центрируем, только держим на экране
+
+    StepDiff m_stepDiff;             // Изменения относительно предыдущего шага
+    bool m_highlightChanges;         // Режим подсветки изменений
+    QByteArray m_diffKey;            // Пара шагов, чьи изменения сейчас нужны
     void centerCurrentThumbnail();
 };
 
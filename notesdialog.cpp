@@ -1,12 +1,12 @@
 #include "notesdialog.h"
+#include "notesmodel.h"
 
 #include <QVBoxLayout>
 #include <QHBoxLayout>
-#include <QListWidget>
+#include <QListView>
 #include <QTextEdit>
 #include <QPushButton>
 #include <QFile>
-#include <QTextStream>
 #include <QDateTime>
 #include <QMessageBox>
 #include <QInputDialog>
@@ -21,8 +21,11 @@ NotesDialog::NotesDialog(int currentStep, QWidget *parent)
 
     QVBoxLayout *mainLayout = new QVBoxLayout(this);
 
-    // Список замечаний
-    m_notesList = new QListWidget(this);
+    // Список замечаний: новые сверху, старые дочитываются из файла при прокрутке
+    m_notesModel = new NotesModel(notesFilePath(currentStep), this);
+    m_notesList = new QListView(this);
+    m_notesList->setUniformItemSizes(true);
+    m_notesList->setModel(m_notesModel);
     mainLayout->addWidget(m_notesList);
 
     // Поле редактирования
@@ -53,12 +56,30 @@ NotesDialog::NotesDialog(int currentStep, QWidget *parent)
     connect(m_addButton, &QPushButton::clicked, this, &NotesDialog::addNote);
     connect(m_editButton, &QPushButton::clicked, this, &NotesDialog::editNote);
     connect(m_deleteButton, &QPushButton::clicked, this, &NotesDialog::deleteNote);
-    connect(m_notesList, &QListWidget::currentRowChanged, this, &NotesDialog::updateButtons);
+    connect(m_notesList->selectionModel(), &QItemSelectionModel::currentRowChanged, this, &NotesDialog::updateButtons);
 }
 
 NotesDialog::~NotesDialog()
 {
-    saveNotes();
+    // Добавление, правка и удаление сохраняются сразу; здесь - только то,
+    // что не удалось записать раньше
+    if (m_notesModel->isDirty()) {
+        saveNotes();
+    }
+}
+
+QString NotesDialog::notesFilePath(int step)
+{
+    return QString("resources/notes_step%1.txt").arg(step + 1);
+}
+
+QStringList NotesDialog::readNotes(int step)
+{
+    QFile file(notesFilePath(step));
+    if (!file.open(QIODevice::ReadOnly)) {
+        return QStringList();
+    }
+    return NotesModel::parseNotes(file.readAll());
 }
 
 void NotesDialog::loadNotes()
@@ -69,18 +90,9 @@ void NotesDialog::loadNotes()
         resourcesDir.mkpath(".");
     }
 
-    QString fileName = QString("resources/notes_step%1.txt").arg(m_currentStep + 1);
-    QFile file(fileName);
-
-    if (file.open(QIODevice::ReadOnly | QIODevice::Text)) {
-        QTextStream in(&file);
-        while (!in.atEnd()) {
-            QString line = in.readLine();
-            if (!line.isEmpty()) {
-                m_notesList->addItem(line);
-            }
-        }
-        file.close();
+    // Первая порция - последние замечания; остальное читается по мере прокрутки
+    if (m_notesModel->canFetchMore(QModelIndex())) {
+        m_notesModel->fetchMore(QModelIndex());
     }
 }
 
@@ -92,18 +104,18 @@ void NotesDialog::saveNotes()
         resourcesDir.mkpath(".");
     }
 
-    QString fileName = QString("resources/notes_step%1.txt").arg(m_currentStep + 1);
-    QFile file(fileName);
-
-    if (file.open(QIODevice::WriteOnly | QIODevice::Text)) {
-        QTextStream out(&file);
-        for (int i = 0; i < m_notesList->count(); ++i) {
-            out << m_notesList->item(i)->text() << "\n";
-        }
-        file.close();
+    // Файл переписывается, только если есть несохраненные правки
+    if (m_notesModel->save()) {
+        emit notesCountChanged(m_currentStep, m_notesModel->totalCount());
     }
 }
 
+int NotesDialog::currentRow() const
+{
+    QModelIndex current = m_notesList->currentIndex();
+    return current.isValid() ? current.row() : -1;
+}
+
 QString NotesDialog::getCurrentDateTime() const
 {
     return QDateTime::currentDateTime().toString("dd.MM.yyyy hh:mm");
@@ -118,18 +130,20 @@ void NotesDialog::addNote()
     }
 
     QString noteWithTime = QString("[%1] %2").arg(getCurrentDateTime()).arg(noteText);
-    m_notesList->addItem(noteWithTime);
     m_noteEdit->clear();
 
-    saveNotes();
+    // Новое замечание дописывается в конец файла, без перезаписи истории
+    if (m_notesModel->appendNote(noteWithTime)) {
+        saveNotes();
+    }
 }
 
 void NotesDialog::editNote()
 {
-    int currentRow = m_notesList->currentRow();
-    if (currentRow < 0) return;
+    int row = currentRow();
+    if (row < 0) return;
 
-    QString currentText = m_notesList->currentItem()->text();
+    QString currentText = m_notesModel->note(row);
     // Извлекаем только текст без времени
     QString noteText = currentText.mid(currentText.indexOf("]") + 2);
 
@@ -161,7 +175,7 @@ void NotesDialog::editNote()
         QString newText = textEdit->toPlainText().trimmed();
         if (!newText.isEmpty()) {
             QString newNoteWithTime = QString("[%1] %2").arg(getCurrentDateTime()).arg(newText);
-            m_notesList->currentItem()->setText(newNoteWithTime);
+            m_notesModel->setNote(row, newNoteWithTime);
             saveNotes();
         }
     }
@@ -169,12 +183,12 @@ void NotesDialog::editNote()
 
 void NotesDialog::deleteNote()
 {
-    int currentRow = m_notesList->currentRow();
-    if (currentRow < 0) return;
+    int row = currentRow();
+    if (row < 0) return;
 
     if (QMessageBox::question(this, "Подтверждение",
                               "Удалить выбранное замечание?") == QMessageBox::Yes) {
-        delete m_notesList->takeItem(currentRow);
+        m_notesModel->removeNote(row);
         saveNotes();
         updateButtons();
     }
@@ -182,27 +196,7 @@ void NotesDialog::deleteNote()
 
 void NotesDialog::updateButtons()
 {
-    bool hasSelection = m_notesList->currentRow() >= 0;
+    bool hasSelection = currentRow() >= 0;
     m_editButton->setEnabled(hasSelection);
     m_deleteButton->setEnabled(hasSelection);
 }
-
-QString NotesDialog::getNotes() const
-{
-    QStringList notes;
-    for (int i = 0; i < m_notesList->count(); ++i) {
-        notes << m_notesList->item(i)->text();
-    }
-    return notes.join("\n");
-}
-
-void NotesDialog::setNotes(const QString &notes)
-{
-    m_notesList->clear();
-    QStringList noteList = notes.split("\n", Qt::SkipEmptyParts);
-    foreach (const QString &note, noteList) {
-        if (!note.trimmed().isEmpty()) {
-            m_notesList->addItem(note);
-        }
-    }
-}
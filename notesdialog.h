@@ -3,8 +3,9 @@
 
 #include <QDialog>
 #include <QObject>
-#include <QListWidget>
+#include <QListView>
 
+class NotesModel;
 class QPushButton;
 class QTextEdit;
 
@@ -15,8 +16,13 @@ public:
     explicit NotesDialog(int currentStep, QWidget *parent = nullptr);
     ~NotesDialog();
 
-    QString getNotes() const;
-    void setNotes(const QString &notes);
+    // Файл замечаний шага и чтение его без открытия диалога (экспорт и т.п.)
+    static QString notesFilePath(int step);
+    static QStringList readNotes(int step);
+
+signals:
+    // Замечания шага сохранены в файл; count - сколько их теперь
+    void notesCountChanged(int step, int count);
 
 private slots:
     void addNote();
@@ -29,7 +35,10 @@ private:
     void saveNotes();
     QString getCurrentDateTime() const;
 
-    QListWidget *m_notesList;
+    int currentRow() const;
+
+    QListView *m_notesList;
+    NotesModel *m_notesModel;        // Замечания подгружаются с конца файла по мере прокрутки
     QTextEdit *m_noteEdit;
     QPushButton *m_addButton;
     QPushButton *m_editButton;
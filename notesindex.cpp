@@ -0,0 +1,97 @@
+#include "notesindex.h"
+#include "notesdialog.h"
+#include "notesmodel.h"
+#include "logging.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QtConcurrent/QtConcurrentMap>
+
+NotesIndex::NotesIndex(QObject *parent)
+    : QObject(parent)
+    , m_built(false)
+{
+    connect(&m_watcher, &QFutureWatcher<Entry>::finished, this, &NotesIndex::onBuildFinished);
+}
+
+NotesIndex::~NotesIndex()
+{
+    m_watcher.cancel();
+    m_watcher.waitForFinished();
+}
+
+void NotesIndex::build(int stepCount)
+{
+    m_watcher.cancel();
+    m_watcher.waitForFinished();
+
+    m_built = false;
+    m_updatedDuringBuild.clear();
+    m_entries = QVector<Entry>(stepCount);
+
+    QVector<int> steps(stepCount);
+    for (int i = 0; i < stepCount; ++i) {
+        steps[i] = i;
+    }
+    m_watcher.setFuture(QtConcurrent::mapped(steps, &NotesIndex::scanStep));
+}
+
+NotesIndex::Entry NotesIndex::scanStep(int step)
+{
+    Entry entry;
+    entry.step = step;
+
+    QFile file(NotesDialog::notesFilePath(step));
+    if (!file.open(QIODevice::ReadOnly)) {
+        return entry;
+    }
+    entry.modified = QFileInfo(file).lastModified();
+
+    entry.count = NotesModel::countNotes(&file, file.size());
+    return entry;
+}
+
+void NotesIndex::onBuildFinished()
+{
+    if (m_watcher.isCanceled()) return;
+
+    const QList<Entry> results = m_watcher.future().results();
+    for (const Entry &entry : results) {
+        if (entry.step >= 0 && entry.step < m_entries.size() && !m_updatedDuringBuild.contains(entry.step)) {
+            m_entries[entry.step] = entry;
+        }
+    }
+    m_updatedDuringBuild.clear();
+
+    m_built = true;
+    qCDebug(lcNotes) << "Notes index built for" << m_entries.size() << "steps";
+    emit built();
+}
+
+int NotesIndex::count(int step) const
+{
+    return (step >= 0 && step < m_entries.size()) ? m_entries[step].count : 0;
+}
+
+QDateTime NotesIndex::lastModified(int step) const
+{
+    return (step >= 0 && step < m_entries.size()) ? m_entries[step].modified : QDateTime();
+}
+
+void NotesIndex::update(int step, int count)
+{
+    if (step < 0 || step >= m_entries.size()) return;
+
+    if (!m_built) {
+        m_updatedDuringBuild.insert(step);
+    }
+
+    Entry &entry = m_entries[step];
+    entry.step = step;
+    const QDateTime modified = QFileInfo(NotesDialog::notesFilePath(step)).lastModified();
+    if (entry.count == count && entry.modified == modified) return;
+
+    entry.count = count;
+    entry.modified = modified;
+    emit countChanged(step, count);
+}
@@ -0,0 +1,53 @@
+#ifndef NOTESINDEX_H
+#define NOTESINDEX_H
+
+#include <QObject>
+#include <QDateTime>
+#include <QFutureWatcher>
+#include <QSet>
+#include <QVector>
+
+// Индекс замечаний: число замечаний и время изменения файла по каждому шагу.
+// Строится при запуске одним параллельным проходом по файлам notes_stepN.txt,
+// дальше обновляется по изменениям из NotesDialog - при навигации файлы не читаются
+class NotesIndex : public QObject {
+    Q_OBJECT
+
+public:
+    struct Entry {
+        int step = -1;
+        int count = 0;
+        QDateTime modified;
+    };
+
+    explicit NotesIndex(QObject *parent = nullptr);
+    ~NotesIndex();
+
+    void build(int stepCount);
+    bool isBuilt() const { return m_built; }
+
+    int count(int step) const;
+    // Время изменения файла замечаний шага (пустое - файла нет)
+    QDateTime lastModified(int step) const;
+
+    // Изменение из диалога замечаний: файл уже сохранен, число известно
+    void update(int step, int count);
+
+signals:
+    // Изменилось число замечаний шага или время изменения его файла
+    void countChanged(int step, int count);
+    void built();
+
+private slots:
+    void onBuildFinished();
+
+private:
+    static Entry scanStep(int step);
+
+    QVector<Entry> m_entries;
+    QFutureWatcher<Entry> m_watcher;
+    QSet<int> m_updatedDuringBuild; // Их результат прохода уже устарел
+    bool m_built;
+};
+
+#endif // NOTESINDEX_H
@@ -0,0 +1,260 @@
+#include "notesmodel.h"
+#include "logging.h"
+
+#include <QFile>
+#include <QSaveFile>
+
+namespace {
+
+// Порция чтения с конца файла и сколько замечаний добирать за один fetchMore
+const qint64 ChunkBytes = 16 * 1024;
+const int BatchNotes = 100;
+
+QString decodeLine(QByteArray line)
+{
+    if (line.endsWith('\r')) {
+        line.chop(1);
+    }
+    return QString::fromUtf8(line);
+}
+
+}
+
+NotesModel::NotesModel(const QString &filePath, QObject *parent)
+    : QAbstractListModel(parent)
+    , m_filePath(filePath)
+    , m_unreadBytes(QFile(filePath).size())
+    , m_unreadCount(m_unreadBytes > 0 ? -1 : 0)
+    , m_dirty(false)
+{
+}
+
+int NotesModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : m_notes.size();
+}
+
+QVariant NotesModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= m_notes.size()) {
+        return QVariant();
+    }
+    if (role == Qt::DisplayRole || role == Qt::ToolTipRole) {
+        return m_notes.at(index.row());
+    }
+    return QVariant();
+}
+
+QString NotesModel::note(int row) const
+{
+    return m_notes.value(row);
+}
+
+bool NotesModel::canFetchMore(const QModelIndex &parent) const
+{
+    return !parent.isValid() && m_unreadBytes > 0;
+}
+
+void NotesModel::fetchMore(const QModelIndex &parent)
+{
+    if (parent.isValid() || m_unreadBytes <= 0) {
+        return;
+    }
+
+    QFile file(m_filePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qCWarning(lcNotes) << "Failed to read notes:" << m_filePath << file.errorString();
+        m_unreadBytes = 0;
+        m_unreadCount = 0;
+        return;
+    }
+
+    QStringList batch;
+    qint64 chunkSize = ChunkBytes;
+    while (batch.size() < BatchNotes && m_unreadBytes > 0) {
+        const qint64 start = qMax<qint64>(0, m_unreadBytes - chunkSize);
+        file.seek(start);
+        const QByteArray chunk = file.read(m_unreadBytes - start);
+        if (chunk.size() != m_unreadBytes - start) {
+            m_unreadBytes = 0;
+            break;
+        }
+
+        // Блок, скорее всего, начинается посреди строки: берем только
+        // строки после первого переноса, остаток дочитаем следующим блоком
+        int firstLine = 0;
+        if (start > 0) {
+            int lineBreak = chunk.indexOf('\n');
+            if (lineBreak < 0 || lineBreak == chunk.size() - 1) {
+                chunkSize *= 2;     // Строка длиннее блока
+                continue;
+            }
+            firstLine = lineBreak + 1;
+        }
+
+        const QStringList lines = parseNotes(chunk.mid(firstLine));
+        for (int i = lines.size() - 1; i >= 0; --i) {
+            batch << lines.at(i);
+        }
+        m_unreadBytes = start + firstLine;
+        chunkSize = ChunkBytes;
+    }
+
+    if (m_unreadBytes == 0) {
+        m_unreadCount = 0;
+    } else if (m_unreadCount >= 0) {
+        m_unreadCount = qMax(0, m_unreadCount - int(batch.size()));
+    }
+
+    if (batch.isEmpty()) {
+        return;
+    }
+
+    beginInsertRows(QModelIndex(), m_notes.size(), m_notes.size() + batch.size() - 1);
+    m_notes += batch;
+    endInsertRows();
+
+    qCDebug(lcNotes) << "Fetched" << batch.size() << "notes," << m_unreadBytes << "bytes left in" << m_filePath;
+}
+
+int NotesModel::totalCount()
+{
+    if (m_unreadCount < 0) {
+        // Считаем строки непрочитанной части один раз - дальше счетчик
+        // уменьшается при дочитывании
+        QFile file(m_filePath);
+        m_unreadCount = file.open(QIODevice::ReadOnly) ? countNotes(&file, m_unreadBytes) : 0;
+    }
+    return m_notes.size() + m_unreadCount;
+}
+
+bool NotesModel::appendNote(const QString &note)
+{
+    beginInsertRows(QModelIndex(), 0, 0);
+    m_notes.prepend(note);
+    endInsertRows();
+
+    // С несохраненными правками файл все равно переписывается целиком
+    if (m_dirty) {
+        return save();
+    }
+
+    QFile file(m_filePath);
+    if (!file.open(QIODevice::ReadWrite | QIODevice::Append)) {
+        qCWarning(lcNotes) << "Failed to append note:" << m_filePath << file.errorString();
+        m_dirty = true;
+        return false;
+    }
+
+    // Последняя строка файла могла остаться без переноса
+    QByteArray line = note.toUtf8() + '\n';
+    if (file.size() > 0 && file.seek(file.size() - 1) && file.read(1) != "\n") {
+        line.prepend('\n');
+    }
+    return file.write(line) == line.size();
+}
+
+void NotesModel::setNote(int row, const QString &note)
+{
+    if (row < 0 || row >= m_notes.size()) {
+        return;
+    }
+    m_notes[row] = note;
+    m_dirty = true;
+    emit dataChanged(index(row), index(row));
+}
+
+void NotesModel::removeNote(int row)
+{
+    if (row < 0 || row >= m_notes.size()) {
+        return;
+    }
+    beginRemoveRows(QModelIndex(), row, row);
+    m_notes.removeAt(row);
+    endRemoveRows();
+    m_dirty = true;
+}
+
+bool NotesModel::save()
+{
+    if (!m_dirty) {
+        return true;
+    }
+
+    QSaveFile out(m_filePath);
+    if (!out.open(QIODevice::WriteOnly)) {
+        qCWarning(lcNotes) << "Failed to save notes:" << m_filePath << out.errorString();
+        return false;
+    }
+
+    // Непрочитанное начало переносим байтами, не разбирая на строки
+    if (m_unreadBytes > 0) {
+        QFile in(m_filePath);
+        if (!in.open(QIODevice::ReadOnly)) {
+            out.cancelWriting();
+            return false;
+        }
+        qint64 left = m_unreadBytes;
+        char lastByte = '\n';
+        while (left > 0) {
+            const QByteArray chunk = in.read(qMin<qint64>(left, 256 * 1024));
+            if (chunk.isEmpty() || out.write(chunk) != chunk.size()) {
+                out.cancelWriting();
+                return false;
+            }
+            lastByte = chunk.back();
+            left -= chunk.size();
+        }
+        // Последняя непрочитанная строка могла быть без переноса
+        if (lastByte != '\n') {
+            out.write("\n");
+        }
+    }
+
+    for (int i = m_notes.size() - 1; i >= 0; --i) {
+        out.write(m_notes.at(i).toUtf8() + '\n');
+    }
+
+    if (!out.commit()) {
+        qCWarning(lcNotes) << "Failed to save notes:" << m_filePath << out.errorString();
+        return false;
+    }
+    m_dirty = false;
+    return true;
+}
+
+QStringList NotesModel::parseNotes(const QByteArray &data)
+{
+    QStringList notes;
+    const QList<QByteArray> lines = data.split('\n');
+    for (const QByteArray &line : lines) {
+        QString note = decodeLine(line);
+        if (!note.isEmpty()) {
+            notes << note;
+        }
+    }
+    return notes;
+}
+
+int NotesModel::countNotes(QIODevice *device, qint64 bytes)
+{
+    // Непустые строки по байтам - столько же, сколько вернет parseNotes()
+    int count = 0;
+    bool lineHasText = false;
+    qint64 left = bytes;
+    while (left > 0) {
+        const QByteArray chunk = device->read(qMin<qint64>(left, 256 * 1024));
+        if (chunk.isEmpty()) break;
+        left -= chunk.size();
+
+        for (char c : chunk) {
+            if (c == '\n') {
+                count += lineHasText ? 1 : 0;
+                lineHasText = false;
+            } else if (c != '\r') {
+                lineHasText = true;
+            }
+        }
+    }
+    return count + (lineHasText ? 1 : 0);
+}
@@ -0,0 +1,51 @@
+#ifndef NOTESMODEL_H
+#define NOTESMODEL_H
+
+#include <QAbstractListModel>
+#include <QStringList>
+
+class QIODevice;
+
+// Модель замечаний шага для списка в NotesDialog.
+// Файл читается с конца порциями через fetchMore, новые замечания первыми:
+// диалог открывается за постоянное время при любой длине истории.
+// Добавление дописывает строку в конец файла; правка и удаление
+// переписывают файл - непрочитанное начало копируется байтами как есть
+class NotesModel : public QAbstractListModel {
+    Q_OBJECT
+
+public:
+    explicit NotesModel(const QString &filePath, QObject *parent = nullptr);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+    bool canFetchMore(const QModelIndex &parent) const override;
+    void fetchMore(const QModelIndex &parent) override;
+
+    QString note(int row) const;
+    // Число замечаний в файле вместе с непрочитанными
+    int totalCount();
+
+    bool appendNote(const QString &note);
+    void setNote(int row, const QString &note);
+    void removeNote(int row);
+
+    bool isDirty() const { return m_dirty; }
+    // Переписывает файл, если есть несохраненные правки
+    bool save();
+
+    // Формат файла замечаний - одно замечание на строку в UTF-8, пустые строки
+    // пропускаются. Разбор в порядке файла и подсчет без разбора в QString
+    // (первые bytes байт устройства) - общие для модели, индекса и экспорта
+    static QStringList parseNotes(const QByteArray &data);
+    static int countNotes(QIODevice *device, qint64 bytes);
+
+private:
+    QString m_filePath;
+    QStringList m_notes;     // Прочитанные замечания, новые первыми
+    qint64 m_unreadBytes;    // Непрочитанное начало файла [0, m_unreadBytes)
+    int m_unreadCount;       // Замечаний в непрочитанной части; -1 - еще не считали
+    bool m_dirty;
+};
+
+#endif // NOTESMODEL_H
@@ -0,0 +1,223 @@
+#include "sessionsnapshot.h"
+#include "logging.h"
+#include "stepsource.h"
+
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+#include <cstring>
+
+namespace {
+
+const quint32 SessionMagic = 0x46425353;    // "FBSS"
+const quint32 ThumbnailsMagic = 0x46425454; // "FBTT"
+const quint16 FormatVersion = 2;
+
+qint64 modifiedMs(const QFileInfo &info)
+{
+    return info.lastModified().toMSecsSinceEpoch();
+}
+
+bool openStream(QDataStream &stream, quint32 magic)
+{
+    stream.setVersion(QDataStream::Qt_5_12);
+
+    quint32 fileMagic = 0;
+    quint16 version = 0;
+    stream >> fileMagic >> version;
+    return stream.status() == QDataStream::Ok && fileMagic == magic && version == FormatVersion;
+}
+
+}
+
+QString SessionSnapshot::defaultPath()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/session.dat";
+}
+
+QString SessionSnapshot::defaultThumbnailPath()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/thumbnails.dat";
+}
+
+void SessionSnapshot::discard()
+{
+    QFile::remove(defaultPath());
+}
+
+bool SessionSnapshot::load(const QString &filePath)
+{
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    QDataStream in(&file);
+    if (!openStream(in, SessionMagic)) {
+        qCDebug(lcResources) << "Session snapshot has unknown format:" << filePath;
+        return false;
+    }
+
+    qint32 savedStep = -1;
+    quint32 count = 0;
+    in >> savedStep >> windowGeometry >> resourcesDir >> resourcesModifiedMs >> thumbnailFile >> count;
+
+    steps.clear();
+    steps.reserve(int(qMin<quint32>(count, 100000)));
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        StepFile step;
+        in >> step.path >> step.size >> step.modifiedMs;
+        steps.append(step);
+    }
+
+    currentStep = savedStep;
+    return in.status() == QDataStream::Ok;
+}
+
+bool SessionSnapshot::save(const QString &filePath) const
+{
+    QDir().mkpath(QFileInfo(filePath).absolutePath());
+
+    QSaveFile file(filePath);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_5_12);
+    out << SessionMagic << FormatVersion;
+    out << qint32(currentStep) << windowGeometry << resourcesDir << resourcesModifiedMs
+        << thumbnailFile << quint32(steps.size());
+
+    for (const StepFile &step : steps) {
+        out << step.path << step.size << step.modifiedMs;
+    }
+
+    return out.status() == QDataStream::Ok && file.commit();
+}
+
+void SessionSnapshot::setSteps(const QStringList &imagePaths, const QString &resourcesPath)
+{
+    resourcesDir = resourcesPath;
+    resourcesModifiedMs = modifiedMs(QFileInfo(resourcesPath));
+
+    steps.clear();
+    steps.reserve(imagePaths.size());
+    for (const QString &path : imagePaths) {
+        const StepSource::FileStat info = StepSource::stat(path);
+        StepFile step;
+        step.path = path;
+        step.size = info.size;
+        step.modifiedMs = info.modified.toMSecsSinceEpoch();
+        steps.append(step);
+    }
+}
+
+bool SessionSnapshot::matchesDisk() const
+{
+    QFileInfo dirInfo(resourcesDir);
+    if (!dirInfo.isDir() || modifiedMs(dirInfo) != resourcesModifiedMs) {
+        return false;
+    }
+
+    // Шаг из архива считается измененным вместе с самим архивом
+    for (const StepFile &step : steps) {
+        const StepSource::FileStat info = StepSource::stat(step.path);
+        if (!info.exists || info.size != step.size || info.modified.toMSecsSinceEpoch() != step.modifiedMs) {
+            return false;
+        }
+    }
+    return true;
+}
+
+QStringList SessionSnapshot::imagePaths() const
+{
+    QStringList paths;
+    paths.reserve(steps.size());
+    for (const StepFile &step : steps) {
+        paths << step.path;
+    }
+    return paths;
+}
+
+QVector<ImageStore::WarmEntry> SessionSnapshot::loadWarmEntries(const QString &filePath)
+{
+    QVector<ImageStore::WarmEntry> entries;
+
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return entries;
+    }
+
+    QDataStream in(&file);
+    if (!openStream(in, ThumbnailsMagic)) {
+        return entries;
+    }
+
+    // Ключи содержимого посчитаны другим qHashBits - файл не годится целиком
+    QByteArray keyTag;
+    in >> keyTag;
+    if (in.status() != QDataStream::Ok || keyTag != ImageStore::contentKeyTag()) {
+        qCDebug(lcResources) << "Warm thumbnails use another content key algorithm:" << keyTag;
+        return entries;
+    }
+
+    quint32 count = 0;
+    in >> count;
+    entries.reserve(int(qMin<quint32>(count, 100000)));
+
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        ImageStore::WarmEntry entry;
+        QSize thumbnailSize;
+        qint32 thumbnailFormat = 0;
+        QByteArray pixels;
+        in >> entry.path >> entry.size >> entry.modifiedMs >> entry.contentKey >> entry.imageSize
+           >> thumbnailSize >> thumbnailFormat >> pixels;
+
+        // Пиксели лежат как есть, без PNG: восстановление - одно копирование
+        if (thumbnailSize.isValid() && thumbnailFormat > QImage::Format_Invalid
+            && thumbnailFormat < QImage::NImageFormats) {
+            QImage thumbnail(thumbnailSize, QImage::Format(thumbnailFormat));
+            if (!thumbnail.isNull() && qint64(thumbnail.sizeInBytes()) == pixels.size()) {
+                std::memcpy(thumbnail.bits(), pixels.constData(), size_t(pixels.size()));
+                entry.thumbnail = thumbnail;
+            }
+        }
+
+        if (in.status() == QDataStream::Ok) {
+            entries.append(entry);
+        }
+    }
+    return entries;
+}
+
+bool SessionSnapshot::saveWarmEntries(const QString &filePath, const QVector<ImageStore::WarmEntry> &entries)
+{
+    QDir().mkpath(QFileInfo(filePath).absolutePath());
+
+    QSaveFile file(filePath);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_5_12);
+    out << ThumbnailsMagic << FormatVersion << ImageStore::contentKeyTag() << quint32(entries.size());
+
+    for (const ImageStore::WarmEntry &entry : entries) {
+        const QImage &thumbnail = entry.thumbnail;
+        QByteArray pixels;
+        if (!thumbnail.isNull()) {
+            pixels = QByteArray(reinterpret_cast<const char *>(thumbnail.constBits()), int(thumbnail.sizeInBytes()));
+        }
+
+        out << entry.path << entry.size << entry.modifiedMs << entry.contentKey << entry.imageSize
+            << thumbnail.size() << qint32(thumbnail.format()) << pixels;
+    }
+
+    return out.status() == QDataStream::Ok && file.commit();
+}
@@ -0,0 +1,49 @@
+#ifndef SESSIONSNAPSHOT_H
+#define SESSIONSNAPSHOT_H
+
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include "imagestore.h"
+
+// Снимок сессии для быстрого повторного запуска: текущий шаг, геометрия
+// окна и упорядоченный список шагов с размерами и mtime. Прогретые
+// миниатюры и ключи содержимого лежат в отдельном файле, на который
+// снимок ссылается; файл с ключами другого алгоритма отбрасывается
+class SessionSnapshot {
+public:
+    struct StepFile {
+        QString path;
+        qint64 size = -1;
+        qint64 modifiedMs = 0;
+    };
+
+    int currentStep = -1;
+    QByteArray windowGeometry;
+    QString resourcesDir;
+    qint64 resourcesModifiedMs = 0;
+    QVector<StepFile> steps;
+    QString thumbnailFile;
+
+    bool load(const QString &filePath);
+    bool save(const QString &filePath) const;
+
+    // Дешевая проверка через stat: папка не менялась (файлы не добавлялись
+    // и не удалялись) и у каждого шага прежние размер и mtime
+    bool matchesDisk() const;
+    QStringList imagePaths() const;
+
+    // Заполняет список шагов по текущему состоянию диска
+    void setSteps(const QStringList &imagePaths, const QString &resourcesPath);
+
+    static QVector<ImageStore::WarmEntry> loadWarmEntries(const QString &filePath);
+    static bool saveWarmEntries(const QString &filePath, const QVector<ImageStore::WarmEntry> &entries);
+
+    static QString defaultPath();
+    static QString defaultThumbnailPath();
+    static void discard();
+};
+
+#endif // SESSIONSNAPSHOT_H
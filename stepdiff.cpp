@@ -0,0 +1,231 @@
+#include "stepdiff.h"
+#include "logging.h"
+
+#include <QElapsedTimer>
+
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FLIPBOOK_DIFF_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define FLIPBOOK_DIFF_NEON
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+const int CacheEntries = 128;   // Пар шагов с посчитанными областями
+const int GridCells = 96;       // Ячеек сетки по длинной стороне изображения
+const int MinCellSize = 8;
+
+// Сравнение идет по байтам, поэтому оба изображения - в одном 32-битном формате
+QImage comparable(const QImage &image, QImage::Format format)
+{
+    return image.format() == format ? image : image.convertToFormat(format);
+}
+
+}
+
+// Разность по модулю - насыщающее вычитание в обе стороны, порог - еще одно
+// насыщающее вычитание: ненулевой байт означает превышение
+bool StepDiff::spanChanged(const uchar *a, const uchar *b, int bytes, uchar threshold)
+{
+    int i = 0;
+
+#if defined(FLIPBOOK_DIFF_SSE2)
+    const __m128i limit = _mm_set1_epi8(char(threshold));
+    __m128i over = _mm_setzero_si128();
+    for (; i + 16 <= bytes; i += 16) {
+        const __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+        const __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+        const __m128i diff = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+        over = _mm_or_si128(over, _mm_subs_epu8(diff, limit));
+    }
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(over, _mm_setzero_si128())) != 0xFFFF) {
+        return true;
+    }
+#elif defined(FLIPBOOK_DIFF_NEON)
+    const uint8x16_t limit = vdupq_n_u8(threshold);
+    uint8x16_t over = vdupq_n_u8(0);
+    for (; i + 16 <= bytes; i += 16) {
+        const uint8x16_t diff = vabdq_u8(vld1q_u8(a + i), vld1q_u8(b + i));
+        over = vorrq_u8(over, vqsubq_u8(diff, limit));
+    }
+    const uint64x2_t wide = vreinterpretq_u64_u8(over);
+    if ((vgetq_lane_u64(wide, 0) | vgetq_lane_u64(wide, 1)) != 0) {
+        return true;
+    }
+#endif
+
+    for (; i < bytes; ++i) {
+        if (qAbs(int(a[i]) - int(b[i])) > threshold) {
+            return true;
+        }
+    }
+    return false;
+}
+
+StepDiff::StepDiff(QObject *parent)
+    : QObject(parent)
+    , m_cache(CacheEntries)
+    , m_queued(nullptr)
+{
+    m_pool.setMaxThreadCount(1);
+}
+
+StepDiff::~StepDiff()
+{
+    m_pool.clear();
+    m_pool.waitForDone();
+}
+
+bool StepDiff::cached(const QByteArray &pairKey, QVector<QRect> *regions) const
+{
+    const QVector<QRect> *found = m_cache.object(pairKey);
+    if (!found) {
+        return false;
+    }
+    if (regions) *regions = *found;
+    return true;
+}
+
+void StepDiff::request(const QByteArray &pairKey, const QImage &previous, const QImage &current)
+{
+    if (m_pending.contains(pairKey)) return;
+
+    // Одна задача в очереди: при быстром листании старая пара из очереди уже
+    // не нужна. Запущенную задачу не снять - ее пара остается в m_pending до результата
+    if (m_queued && m_pool.tryTake(m_queued)) {
+        m_pending.remove(m_queuedKey);
+        delete m_queued;
+    }
+
+    m_pending.insert(pairKey);
+    m_queuedKey = pairKey;
+    m_queued = QRunnable::create([this, pairKey, previous, current]() {
+        QElapsedTimer timer;
+        timer.start();
+        const QVector<QRect> regions = changedRegions(previous, current);
+        const qint64 diffUs = timer.nsecsElapsed() / 1000;
+
+        QMetaObject::invokeMethod(this, [this, pairKey, regions, diffUs]() {
+            finish(pairKey, regions, diffUs);
+        }, Qt::QueuedConnection);
+    });
+    m_pool.start(m_queued);
+}
+
+void StepDiff::finish(const QByteArray &pairKey, const QVector<QRect> &regions, qint64 diffUs)
+{
+    qCDebug(lcPerf) << "step diff" << diffUs << "us," << regions.size() << "regions";
+
+    // Задача уже отработала и удалена пулом
+    if (pairKey == m_queuedKey) {
+        m_queued = nullptr;
+        m_queuedKey.clear();
+    }
+    m_pending.remove(pairKey);
+    m_cache.insert(pairKey, new QVector<QRect>(regions));
+    emit regionsReady(pairKey, regions);
+}
+
+QVector<QRect> StepDiff::changedRegions(const QImage &previous, const QImage &current, int threshold)
+{
+    QVector<QRect> regions;
+    if (previous.isNull() || current.isNull()) {
+        return regions;
+    }
+
+    const QImage::Format format = current.hasAlphaChannel() ? QImage::Format_ARGB32_Premultiplied
+                                                            : QImage::Format_RGB32;
+    const QImage b = comparable(current, format);
+    QImage a = comparable(previous, format);
+    if (a.size() != b.size()) {
+        a = a.scaled(b.size(), Qt::IgnoreAspectRatio, Qt::FastTransformation);
+    }
+
+    const int width = b.width();
+    const int height = b.height();
+    const int cell = qMax(MinCellSize, qMax(width, height) / GridCells);
+    const int columns = (width + cell - 1) / cell;
+    const int rows = (height + cell - 1) / cell;
+
+    // Ячейка считается измененной, если в ней отличается несколько строк:
+    // одиночные выбросы сжатия не подсвечиваются
+    const int rowsNeeded = qMax(1, cell / 8);
+    QVector<int> changedRows(columns * rows, 0);
+    const uchar limit = uchar(qBound(0, threshold, 255));
+
+    for (int y = 0; y < height; ++y) {
+        const uchar *lineA = a.constScanLine(y);
+        const uchar *lineB = b.constScanLine(y);
+        int *cellRow = changedRows.data() + (y / cell) * columns;
+
+        for (int column = 0; column < columns; ++column) {
+            if (cellRow[column] >= rowsNeeded) continue;   // Уже изменена - дальше не смотрим
+
+            const int x = column * cell;
+            const int span = qMin(cell, width - x);
+            if (spanChanged(lineA + x * 4, lineB + x * 4, span * 4, limit)) {
+                ++cellRow[column];
+            }
+        }
+    }
+
+    // Связные группы измененных ячеек (с диагональными соседями) -> прямоугольники
+    QVector<bool> visited(columns * rows, false);
+    QVector<int> stack;
+    for (int start = 0; start < columns * rows; ++start) {
+        if (visited[start] || changedRows[start] < rowsNeeded) continue;
+
+        int left = columns, top = rows, right = -1, bottom = -1;
+        visited[start] = true;
+        stack.append(start);
+        while (!stack.isEmpty()) {
+            const int index = stack.takeLast();
+            const int cx = index % columns;
+            const int cy = index / columns;
+            left = qMin(left, cx);
+            right = qMax(right, cx);
+            top = qMin(top, cy);
+            bottom = qMax(bottom, cy);
+
+            for (int ny = qMax(0, cy - 1); ny <= qMin(rows - 1, cy + 1); ++ny) {
+                for (int nx = qMax(0, cx - 1); nx <= qMin(columns - 1, cx + 1); ++nx) {
+                    const int neighbour = ny * columns + nx;
+                    if (!visited[neighbour] && changedRows[neighbour] >= rowsNeeded) {
+                        visited[neighbour] = true;
+                        stack.append(neighbour);
+                    }
+                }
+            }
+        }
+
+        regions.append(QRect(left * cell, top * cell, (right - left + 1) * cell, (bottom - top + 1) * cell)
+                           .intersected(b.rect()));
+    }
+
+    // Пересекающиеся и почти касающиеся прямоугольники объединяем, пока есть что объединять
+    bool merged = true;
+    while (merged) {
+        merged = false;
+        for (int i = 0; i < regions.size() && !merged; ++i) {
+            const QRect reach = regions[i].adjusted(-cell, -cell, cell, cell);
+            for (int j = i + 1; j < regions.size(); ++j) {
+                if (reach.intersects(regions[j])) {
+                    regions[i] |= regions[j];
+                    regions.removeAt(j);
+                    merged = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    // Крупные области первыми - их рамки рисуются снизу
+    std::sort(regions.begin(), regions.end(), [](const QRect &l, const QRect &r) {
+        return qint64(l.width()) * l.height() > qint64(r.width()) * r.height();
+    });
+    return regions;
+}
@@ -0,0 +1,53 @@
+#ifndef STEPDIFF_H
+#define STEPDIFF_H
+
+#include <QObject>
+#include <QCache>
+#include <QImage>
+#include <QRect>
+#include <QRunnable>
+#include <QSet>
+#include <QThreadPool>
+#include <QVector>
+
+// Подсветка изменений между соседними шагами.
+// Попиксельная разность с порогом считается векторно (SSE2 или NEON,
+// иначе скалярно) по сетке ячеек; измененные ячейки собираются в связные
+// области и объединяются в прямоугольники. Сравнение идет в рабочем потоке,
+// результат кэшируется по паре ключей - повторный показ шага ничего не считает
+class StepDiff : public QObject {
+    Q_OBJECT
+
+public:
+    explicit StepDiff(QObject *parent = nullptr);
+    ~StepDiff();
+
+    // Порог разности канала, ниже которого пиксели считаются одинаковыми (шум JPEG)
+    static const int DefaultThreshold = 40;
+
+    // Сравнение в рабочем потоке; повторный запрос той же пары, пока она считается, игнорируется
+    void request(const QByteArray &pairKey, const QImage &previous, const QImage &current);
+    bool cached(const QByteArray &pairKey, QVector<QRect> *regions) const;
+
+    // Измененные области в координатах current; previous приводится к его размеру
+    static QVector<QRect> changedRegions(const QImage &previous, const QImage &current,
+                                         int threshold = DefaultThreshold);
+
+    // Есть ли в отрезке строки байт, отличающийся больше чем на threshold.
+    // Векторное ядро changedRegions; хвост короче вектора дочитывается скалярно
+    static bool spanChanged(const uchar *a, const uchar *b, int bytes, uchar threshold);
+
+signals:
+    void regionsReady(const QByteArray &pairKey, const QVector<QRect> &regions);
+
+private:
+    void finish(const QByteArray &pairKey, const QVector<QRect> &regions, qint64 diffUs);
+
+    QCache<QByteArray, QVector<QRect>> m_cache; // Области по паре шагов
+    QSet<QByteArray> m_pending;                 // Пары в очереди и в работе - до прихода результата
+    QRunnable *m_queued;                        // Последняя поставленная задача (может уже идти)
+    QByteArray m_queuedKey;
+    QThreadPool m_pool;
+};
+
+#endif // STEPDIFF_H
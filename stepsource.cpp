@@ -0,0 +1,698 @@
+#include "stepsource.h"
+#include "logging.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QtEndian>
+
+#include <cstring>
+
+#ifdef FLIPBOOK_QT_ZLIB
+#include <QtZlib/zlib.h>
+#else
+#include <zlib.h>
+#endif
+
+namespace {
+
+const QString MemberSeparator = QStringLiteral("!/");
+
+// Члены архива больше этого не читаются целиком в память
+const qint64 MaxMemberSize = qint64(512) * 1024 * 1024;
+
+// Порция сжатых данных, которую MemberDevice читает из архива за раз
+const qint64 InflateChunk = 64 * 1024;
+
+quint16 readU16(const char *data)
+{
+    return qFromLittleEndian<quint16>(reinterpret_cast<const uchar *>(data));
+}
+
+quint32 readU32(const char *data)
+{
+    return qFromLittleEndian<quint32>(reinterpret_cast<const uchar *>(data));
+}
+
+quint64 readU64(const char *data)
+{
+    return qFromLittleEndian<quint64>(reinterpret_cast<const uchar *>(data));
+}
+
+QByteArray readAt(QFile &file, qint64 offset, qint64 size)
+{
+    if (offset < 0 || size < 0 || size > MaxMemberSize || !file.seek(offset)) {
+        return QByteArray();
+    }
+    QByteArray data = file.read(size);
+    return data.size() == size ? data : QByteArray();
+}
+
+// Сырой deflate без заголовка zlib - так данные лежат в ZIP
+QByteArray inflateRaw(const QByteArray &compressed, qint64 size)
+{
+    QByteArray out(int(size), Qt::Uninitialized);
+
+    z_stream stream = {};
+    if (inflateInit2(&stream, -MAX_WBITS) != Z_OK) {
+        return QByteArray();
+    }
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(compressed.constData()));
+    stream.avail_in = uInt(compressed.size());
+    stream.next_out = reinterpret_cast<Bytef *>(out.data());
+    stream.avail_out = uInt(out.size());
+
+    int result = inflate(&stream, Z_FINISH);
+    qint64 written = qint64(stream.total_out);
+    inflateEnd(&stream);
+
+    return (result == Z_STREAM_END && written == size) ? out : QByteArray();
+}
+
+// Член архива как устройство с произвольным доступом. Несжатый читается прямо
+// из файла архива, сжатый (deflate) распаковывается по мере чтения в буфер
+// с уже распакованным началом: кому нужен только заголовок изображения,
+// тот распаковывает несколько килобайт, а не весь член
+class MemberDevice : public QIODevice {
+public:
+    MemberDevice(const QString &archivePath, qint64 dataOffset, qint64 compressedSize, qint64 size, bool deflated)
+        : m_file(archivePath)
+        , m_dataOffset(dataOffset)
+        , m_compressedSize(compressedSize)
+        , m_size(size)
+        , m_deflated(deflated)
+        , m_compressedRead(0)
+        , m_streamReady(false)
+    {
+        m_stream = {};
+    }
+
+    ~MemberDevice() override
+    {
+        close();
+    }
+
+    bool open(OpenMode mode) override
+    {
+        if ((mode & WriteOnly) || m_size < 0 || m_size > MaxMemberSize || !m_file.open(QIODevice::ReadOnly)) {
+            return false;
+        }
+        if (m_deflated) {
+            m_streamReady = inflateInit2(&m_stream, -MAX_WBITS) == Z_OK;
+            if (!m_streamReady) {
+                m_file.close();
+                return false;
+            }
+        }
+        // Без буфера QIODevice: pos() в readData - ровно то место, откуда читают
+        return QIODevice::open(mode | Unbuffered);
+    }
+
+    void close() override
+    {
+        if (m_streamReady) {
+            inflateEnd(&m_stream);
+            m_streamReady = false;
+        }
+        m_stream = {};
+        m_compressedRead = 0;
+        m_inflated.clear();
+        m_input.clear();
+        m_file.close();
+        QIODevice::close();
+    }
+
+    bool isSequential() const override { return false; }
+    qint64 size() const override { return m_size; }
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override
+    {
+        const qint64 start = pos();
+        const qint64 end = qMin(m_size, start + maxSize);
+        if (start >= end) {
+            return 0;
+        }
+
+        if (!m_deflated) {
+            if (!m_file.seek(m_dataOffset + start)) {
+                return -1;
+            }
+            return m_file.read(data, end - start);
+        }
+
+        if (!inflateTo(end)) {
+            setErrorString("Broken deflate data");
+            return -1;
+        }
+        std::memcpy(data, m_inflated.constData() + start, size_t(end - start));
+        return end - start;
+    }
+
+    qint64 writeData(const char *, qint64) override
+    {
+        return -1;
+    }
+
+private:
+    // Дораспаковывает член, пока распакованное начало не дойдет до end
+    bool inflateTo(qint64 end)
+    {
+        while (m_inflated.size() < end) {
+            if (m_stream.avail_in == 0) {
+                const qint64 left = m_compressedSize - m_compressedRead;
+                m_input = left > 0 ? readAt(m_file, m_dataOffset + m_compressedRead, qMin(left, InflateChunk))
+                                   : QByteArray();
+                if (m_input.isEmpty()) {
+                    return false;
+                }
+                m_compressedRead += m_input.size();
+                m_stream.next_in = reinterpret_cast<Bytef *>(m_input.data());
+                m_stream.avail_in = uInt(m_input.size());
+            }
+
+            // Буфер растет вдвое: заголовок читается мелкими порциями, и
+            // распаковка ровно до end означала бы перевыделение на каждую
+            const qint64 have = m_inflated.size();
+            const qint64 want = qMin(m_size, qMax(end, qMax(have * 2, have + InflateChunk)));
+            m_inflated.resize(int(want));
+            m_stream.next_out = reinterpret_cast<Bytef *>(m_inflated.data() + have);
+            m_stream.avail_out = uInt(want - have);
+
+            const int result = inflate(&m_stream, Z_NO_FLUSH);
+            m_inflated.resize(int(want - m_stream.avail_out));
+
+            if (result == Z_STREAM_END) {
+                return m_inflated.size() >= end;
+            }
+            if (result != Z_OK && !(result == Z_BUF_ERROR && m_stream.avail_in == 0)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    QFile m_file;
+    qint64 m_dataOffset;
+    qint64 m_compressedSize;
+    qint64 m_size;
+    bool m_deflated;
+
+    z_stream m_stream;
+    qint64 m_compressedRead;
+    bool m_streamReady;
+    QByteArray m_input;     // Текущая порция сжатых данных
+    QByteArray m_inflated;  // Распакованное начало члена
+};
+
+// ZIP: индекс - центральный каталог в конце файла, данные читаются по
+// смещению локального заголовка. Поддерживаются ZIP64, методы store и deflate
+class ZipSource : public StepSource {
+public:
+    explicit ZipSource(const QString &archivePath) : StepSource(archivePath) {}
+
+    QByteArray read(const QString &member) const override;
+    std::unique_ptr<QIODevice> open(const QString &member) const override;
+
+protected:
+    bool buildIndex() override;
+
+private:
+    qint64 dataOffset(QFile &file, const QString &member, const Member &entry) const;
+
+    mutable QMutex m_offsetsMutex;
+    mutable QHash<QString, qint64> m_dataOffsets; // Начало данных члена - после локального заголовка
+};
+
+bool ZipSource::buildIndex()
+{
+    QFile file(m_archivePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    // Конец центрального каталога: 22 байта плюс комментарий до 64 КБ
+    const qint64 fileSize = file.size();
+    const qint64 tailSize = qMin<qint64>(fileSize, 22 + 0xFFFF);
+    QByteArray tail = readAt(file, fileSize - tailSize, tailSize);
+
+    int eocd = -1;
+    for (int i = tail.size() - 22; i >= 0; --i) {
+        if (readU32(tail.constData() + i) == 0x06054b50) {
+            eocd = i;
+            break;
+        }
+    }
+    if (eocd < 0) {
+        qCWarning(lcResources) << "Not a ZIP archive:" << m_archivePath;
+        return false;
+    }
+
+    const char *end = tail.constData() + eocd;
+    quint64 entryCount = readU16(end + 10);
+    quint64 directorySize = readU32(end + 12);
+    quint64 directoryOffset = readU32(end + 16);
+
+    // ZIP64: локатор лежит сразу перед записью конца каталога
+    if (directoryOffset == 0xFFFFFFFF || entryCount == 0xFFFF) {
+        qint64 locatorOffset = fileSize - tailSize + eocd - 20;
+        QByteArray locator = readAt(file, locatorOffset, 20);
+        if (locator.isEmpty() || readU32(locator.constData()) != 0x07064b50) {
+            return false;
+        }
+        QByteArray record = readAt(file, qint64(readU64(locator.constData() + 8)), 56);
+        if (record.isEmpty() || readU32(record.constData()) != 0x06064b50) {
+            return false;
+        }
+        entryCount = readU64(record.constData() + 32);
+        directorySize = readU64(record.constData() + 40);
+        directoryOffset = readU64(record.constData() + 48);
+    }
+
+    QByteArray directory = readAt(file, qint64(directoryOffset), qint64(directorySize));
+    if (directory.isEmpty() && entryCount > 0) {
+        return false;
+    }
+
+    int pos = 0;
+    for (quint64 i = 0; i < entryCount; ++i) {
+        if (pos + 46 > directory.size() || readU32(directory.constData() + pos) != 0x02014b50) {
+            qCWarning(lcResources) << "Broken ZIP central directory:" << m_archivePath;
+            return false;
+        }
+        const char *header = directory.constData() + pos;
+        const quint16 flags = readU16(header + 8);
+        const quint16 nameLength = readU16(header + 28);
+        const quint16 extraLength = readU16(header + 30);
+        const quint16 commentLength = readU16(header + 32);
+        if (pos + 46 + nameLength + extraLength > directory.size()) {
+            return false;
+        }
+
+        quint64 compressedSize = readU32(header + 20);
+        quint64 size = readU32(header + 24);
+        quint64 offset = readU32(header + 42);
+
+        // Поля 0xFFFFFFFF заменяются значениями из дополнительного поля ZIP64
+        const char *extra = header + 46 + nameLength;
+        for (int e = 0; e + 4 <= extraLength;) {
+            const quint16 id = readU16(extra + e);
+            const quint16 length = readU16(extra + e + 2);
+            if (e + 4 + length > extraLength) {
+                qCWarning(lcResources) << "Broken ZIP extra field:" << m_archivePath;
+                return false;
+            }
+            if (id == 0x0001) {
+                const char *field = extra + e + 4;
+                int used = 0;
+                if (size == 0xFFFFFFFF && used + 8 <= length) { size = readU64(field + used); used += 8; }
+                if (compressedSize == 0xFFFFFFFF && used + 8 <= length) { compressedSize = readU64(field + used); used += 8; }
+                if (offset == 0xFFFFFFFF && used + 8 <= length) { offset = readU64(field + used); }
+                break;
+            }
+            e += 4 + length;
+        }
+
+        // Бит 11 - имя в UTF-8; старые архиваторы пишут в локальной кодировке
+        QByteArray rawName(header + 46, nameLength);
+        QString name = (flags & 0x0800) ? QString::fromUtf8(rawName) : QString::fromLocal8Bit(rawName);
+
+        // Зашифрованные и сжатые не store/deflate члены в индекс не попадают:
+        // иначе шаг нашелся бы, но показывался пустым
+        const quint16 method = readU16(header + 10);
+        if (name.endsWith('/')) {
+            // Каталоги не нужны
+        } else if (flags & 0x0001) {
+            qCWarning(lcResources) << "Skipping encrypted ZIP entry" << name << "in" << m_archivePath;
+        } else if (method != 0 && method != 8) {
+            qCWarning(lcResources) << "Skipping ZIP entry" << name << "with unsupported compression method"
+                                   << method << "in" << m_archivePath;
+        } else {
+            Member member;
+            member.offset = qint64(offset);
+            member.compressedSize = qint64(compressedSize);
+            member.size = qint64(size);
+            member.method = method;
+            addMember(name, member);
+        }
+
+        pos += 46 + nameLength + extraLength + commentLength;
+    }
+    return true;
+}
+
+qint64 ZipSource::dataOffset(QFile &file, const QString &member, const Member &entry) const
+{
+    {
+        QMutexLocker locker(&m_offsetsMutex);
+        auto it = m_dataOffsets.constFind(member);
+        if (it != m_dataOffsets.constEnd()) {
+            return it.value();
+        }
+    }
+
+    // Длины имени и дополнительного поля в локальном заголовке могут
+    // отличаться от центрального каталога, поэтому читаем его - один раз на член
+    QByteArray local = readAt(file, entry.offset, 30);
+    if (local.isEmpty() || readU32(local.constData()) != 0x04034b50) {
+        qCWarning(lcResources) << "Broken ZIP local header:" << member << "in" << m_archivePath;
+        return -1;
+    }
+    const qint64 offset = entry.offset + 30 + readU16(local.constData() + 26) + readU16(local.constData() + 28);
+
+    QMutexLocker locker(&m_offsetsMutex);
+    m_dataOffsets.insert(member, offset);
+    return offset;
+}
+
+QByteArray ZipSource::read(const QString &member) const
+{
+    auto it = m_members.constFind(member);
+    if (it == m_members.constEnd()) {
+        return QByteArray();
+    }
+
+    QFile file(m_archivePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return QByteArray();
+    }
+
+    const qint64 dataOffset = this->dataOffset(file, member, *it);
+    if (dataOffset < 0) {
+        return QByteArray();
+    }
+    QByteArray data = readAt(file, dataOffset, it->compressedSize);
+
+    switch (it->method) {
+    case 0:
+        return data;
+    default:
+        // Другие методы отсеяны при построении индекса
+        return it->size <= MaxMemberSize ? inflateRaw(data, it->size) : QByteArray();
+    }
+}
+
+std::unique_ptr<QIODevice> ZipSource::open(const QString &member) const
+{
+    auto it = m_members.constFind(member);
+    if (it == m_members.constEnd()) {
+        return nullptr;
+    }
+
+    QFile file(m_archivePath);
+    const qint64 dataOffset = file.open(QIODevice::ReadOnly) ? this->dataOffset(file, member, *it) : -1;
+    if (dataOffset < 0) {
+        return nullptr;
+    }
+    return std::make_unique<MemberDevice>(m_archivePath, dataOffset, it->compressedSize, it->size, it->method == 8);
+}
+
+// tar (ustar и GNU): каталога нет, индекс - один проход по заголовкам
+// с пропуском данных. Сжатые .tar.gz не поддерживаются - в них нельзя
+// перейти к члену без распаковки всего, что лежит перед ним
+class TarSource : public StepSource {
+public:
+    explicit TarSource(const QString &archivePath) : StepSource(archivePath) {}
+
+    QByteArray read(const QString &member) const override;
+    std::unique_ptr<QIODevice> open(const QString &member) const override;
+
+protected:
+    bool buildIndex() override;
+};
+
+QByteArray tarString(const char *field, int length)
+{
+    return QByteArray(field, int(qstrnlen(field, size_t(length))));
+}
+
+qint64 tarNumber(const char *field, int length)
+{
+    // Большие размеры GNU tar пишет в двоичном виде со старшим битом
+    if (uchar(field[0]) & 0x80) {
+        qint64 value = 0;
+        for (int i = 1; i < length; ++i) {
+            value = (value << 8) | uchar(field[i]);
+        }
+        return value;
+    }
+    return tarString(field, length).trimmed().toLongLong(nullptr, 8);
+}
+
+// Расширенный заголовок POSIX (pax): записи "<длина> <ключ>=<значение>\n".
+// Нужен только путь - длинные имена и имена не в ASCII пишутся сюда
+QByteArray paxPath(const QByteArray &records)
+{
+    int pos = 0;
+    while (pos < records.size()) {
+        const int space = records.indexOf(' ', pos);
+        if (space < 0) break;
+        const int length = records.mid(pos, space - pos).toInt();
+        if (length <= space - pos + 1 || pos + length > records.size()) break;
+
+        const QByteArray record = records.mid(space + 1, pos + length - space - 2); // Без '\n'
+        if (record.startsWith("path=")) {
+            return record.mid(5);
+        }
+        pos += length;
+    }
+    return QByteArray();
+}
+
+// Контрольная сумма заголовка считается с пробелами на месте своего поля
+bool tarChecksumValid(const QByteArray &block)
+{
+    qint64 sum = 0;
+    for (int i = 0; i < 512; ++i) {
+        sum += (i >= 148 && i < 156) ? ' ' : uchar(block.at(i));
+    }
+    return sum == tarNumber(block.constData() + 148, 8);
+}
+
+bool TarSource::buildIndex()
+{
+    QFile file(m_archivePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    QByteArray longName;
+    qint64 offset = 0;
+    while (offset + 512 <= file.size()) {
+        QByteArray block = readAt(file, offset, 512);
+        if (block.isEmpty() || block.count('\0') == 512) {
+            break;  // Конец архива - нулевой блок
+        }
+        if (!tarChecksumValid(block)) {
+            qCWarning(lcResources) << "Broken tar header at" << offset << "in" << m_archivePath;
+            return false;
+        }
+
+        const char *header = block.constData();
+        const qint64 size = tarNumber(header + 124, 12);
+        if (size < 0 || size > file.size()) {
+            return false;
+        }
+        const char type = header[156];
+        const qint64 dataOffset = offset + 512;
+
+        if (type == 'L') {
+            // GNU: длинное имя следующего члена лежит в данных этого
+            longName = tarString(readAt(file, dataOffset, size).constData(), int(size));
+        } else if (type == 'x') {
+            // POSIX: путь следующего члена из расширенного заголовка
+            longName = paxPath(readAt(file, dataOffset, size));
+        } else if (type == '0' || type == '\0') {
+            QByteArray name = longName;
+            if (name.isEmpty()) {
+                name = tarString(header, 100);
+                if (block.mid(257, 5) == "ustar" && header[345]) {
+                    name = tarString(header + 345, 155) + '/' + name;
+                }
+            }
+            longName.clear();
+
+            Member member;
+            member.offset = dataOffset;
+            member.compressedSize = size;
+            member.size = size;
+            addMember(QString::fromUtf8(name), member);
+        } else {
+            longName.clear();
+        }
+
+        offset = dataOffset + (size + 511) / 512 * 512;
+    }
+    return true;
+}
+
+QByteArray TarSource::read(const QString &member) const
+{
+    auto it = m_members.constFind(member);
+    if (it == m_members.constEnd()) {
+        return QByteArray();
+    }
+
+    QFile file(m_archivePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return QByteArray();
+    }
+    return readAt(file, it->offset, it->size);
+}
+
+std::unique_ptr<QIODevice> TarSource::open(const QString &member) const
+{
+    auto it = m_members.constFind(member);
+    if (it == m_members.constEnd()) {
+        return nullptr;
+    }
+    return std::make_unique<MemberDevice>(m_archivePath, it->offset, it->size, it->size, false);
+}
+
+QMutex registryMutex;
+QHash<QString, std::shared_ptr<StepSource>> registry;
+
+}
+
+StepSource::StepSource(const QString &archivePath)
+    : m_archivePath(archivePath)
+{
+}
+
+StepSource::~StepSource()
+{
+}
+
+qint64 StepSource::memberSize(const QString &member) const
+{
+    auto it = m_members.constFind(member);
+    return it != m_members.constEnd() ? it->size : -1;
+}
+
+void StepSource::addMember(const QString &name, const Member &member)
+{
+    QString cleanName = name;
+    while (cleanName.startsWith("./")) {
+        cleanName.remove(0, 2);
+    }
+    if (cleanName.isEmpty()) {
+        return;
+    }
+    if (!m_members.contains(cleanName)) {
+        m_order << cleanName;
+    }
+    m_members.insert(cleanName, member);
+}
+
+std::shared_ptr<StepSource> StepSource::archive(const QString &archivePath)
+{
+    QFileInfo info(archivePath);
+    if (!info.isFile()) {
+        return nullptr;
+    }
+    const QString key = info.absoluteFilePath();
+    const QDateTime modified = info.lastModified();
+
+    QMutexLocker locker(&registryMutex);
+    std::shared_ptr<StepSource> source = registry.value(key);
+    if (source && source->m_modified == modified) {
+        return source;
+    }
+
+    if (info.suffix().compare("zip", Qt::CaseInsensitive) == 0) {
+        source = std::make_shared<ZipSource>(key);
+    } else if (info.suffix().compare("tar", Qt::CaseInsensitive) == 0) {
+        source = std::make_shared<TarSource>(key);
+    } else {
+        return nullptr;
+    }
+    source->m_modified = modified;
+
+    if (!source->buildIndex()) {
+        qCWarning(lcResources) << "Failed to index archive:" << archivePath;
+        registry.remove(key);
+        return nullptr;
+    }
+
+    qCDebug(lcResources) << "Indexed archive" << archivePath << "with" << source->m_order.size() << "members";
+    registry.insert(key, source);
+    return source;
+}
+
+QString StepSource::memberPath(const QString &archivePath, const QString &member)
+{
+    return archivePath + MemberSeparator + member;
+}
+
+bool StepSource::splitPath(const QString &path, QString *archivePath, QString *member)
+{
+    int separator = path.indexOf(MemberSeparator);
+    if (separator < 0) {
+        return false;
+    }
+    if (archivePath) *archivePath = path.left(separator);
+    if (member) *member = path.mid(separator + MemberSeparator.size());
+    return true;
+}
+
+StepSource::FileStat StepSource::stat(const QString &path)
+{
+    FileStat result;
+
+    QString archivePath, member;
+    if (splitPath(path, &archivePath, &member)) {
+        // Член архива не меняется без изменения самого архива
+        std::shared_ptr<StepSource> source = archive(archivePath);
+        if (source && source->contains(member)) {
+            result.exists = true;
+            result.size = source->memberSize(member);
+            result.modified = source->modified();
+        }
+        return result;
+    }
+
+    QFileInfo info(path);
+    if (info.isFile()) {
+        result.exists = true;
+        result.size = info.size();
+        result.modified = info.lastModified();
+    }
+    return result;
+}
+
+QByteArray StepSource::readFile(const QString &path)
+{
+    QString archivePath, member;
+    if (splitPath(path, &archivePath, &member)) {
+        std::shared_ptr<StepSource> source = archive(archivePath);
+        return source ? source->read(member) : QByteArray();
+    }
+
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return QByteArray();
+    }
+    return file.readAll();
+}
+
+std::unique_ptr<QIODevice> StepSource::openFile(const QString &path, QIODevice::OpenMode mode)
+{
+    std::unique_ptr<QIODevice> device;
+
+    QString archivePath, member;
+    if (splitPath(path, &archivePath, &member)) {
+        std::shared_ptr<StepSource> source = archive(archivePath);
+        device = source ? source->open(member) : nullptr;
+        if (!device) {
+            return nullptr;
+        }
+    } else {
+        device = std::make_unique<QFile>(path);
+    }
+
+    if (!device->open(mode)) {
+        return nullptr;
+    }
+    return device;
+}
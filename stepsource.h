@@ -0,0 +1,73 @@
+#ifndef STEPSOURCE_H
+#define STEPSOURCE_H
+
+#include <QDateTime>
+#include <QHash>
+#include <QIODevice>
+#include <QString>
+#include <QStringList>
+
+#include <memory>
+
+// Источник файлов шагов внутри архива ZIP или tar.
+// Файл в архиве адресуется путем вида "resources/book.zip!/steps/01.png" и
+// может стоять в m_imagePaths наравне с обычными путями. Индекс строится
+// один раз при открытии (центральный каталог ZIP, заголовки tar), при чтении
+// с диска берется только запрошенный член архива - без распаковки на диск.
+//
+// Статические функции stat/readFile/openFile работают с любым путем шага и
+// используются вместо QFile/QFileInfo везде, где читаются изображения и подписи
+class StepSource {
+public:
+    virtual ~StepSource();
+
+    QString archivePath() const { return m_archivePath; }
+    QDateTime modified() const { return m_modified; }
+    QStringList members() const { return m_order; }
+    bool contains(const QString &member) const { return m_members.contains(member); }
+    qint64 memberSize(const QString &member) const;
+
+    // Читает один член архива; потокобезопасно - каждый вызов открывает архив заново
+    virtual QByteArray read(const QString &member) const = 0;
+    // Член архива как устройство (еще не открытое): распаковывается по мере
+    // чтения, поэтому заголовок изображения читается без распаковки всего члена
+    virtual std::unique_ptr<QIODevice> open(const QString &member) const = 0;
+
+    // Открытый архив из общего реестра; при изменении файла архива открывается заново
+    static std::shared_ptr<StepSource> archive(const QString &archivePath);
+
+    static QString memberPath(const QString &archivePath, const QString &member);
+    static bool splitPath(const QString &path, QString *archivePath, QString *member);
+
+    struct FileStat {
+        bool exists = false;
+        qint64 size = -1;
+        QDateTime modified;
+    };
+
+    static FileStat stat(const QString &path);
+    static QByteArray readFile(const QString &path);
+    // Открытое на чтение устройство: QFile для обычного пути, для члена архива -
+    // устройство, которое читает и распаковывает его по мере чтения
+    static std::unique_ptr<QIODevice> openFile(const QString &path,
+                                               QIODevice::OpenMode mode = QIODevice::ReadOnly);
+
+protected:
+    struct Member {
+        qint64 offset = 0;          // ZIP - локальный заголовок, tar - начало данных
+        qint64 compressedSize = 0;
+        qint64 size = 0;
+        int method = 0;             // ZIP: 0 - без сжатия, 8 - deflate
+    };
+
+    explicit StepSource(const QString &archivePath);
+    virtual bool buildIndex() = 0;
+    void addMember(const QString &name, const Member &member);
+
+    QString m_archivePath;
+    QDateTime m_modified;
+    QHash<QString, Member> m_members;
+    QStringList m_order;
+};
+
+#endif // STEPSOURCE_H
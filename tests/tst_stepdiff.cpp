@@ -0,0 +1,121 @@
+#include "stepdiff.h"
+
+#include <QImage>
+#include <QtTest>
+
+namespace {
+
+// Эталон - побайтное сравнение без векторов
+bool scalarSpanChanged(const uchar *a, const uchar *b, int bytes, uchar threshold)
+{
+    for (int i = 0; i < bytes; ++i) {
+        if (qAbs(int(a[i]) - int(b[i])) > threshold) {
+            return true;
+        }
+    }
+    return false;
+}
+
+quint32 nextRandom(quint32 &state)
+{
+    state = state * 1103515245u + 12345u;
+    return state >> 16;
+}
+
+}
+
+class TestStepDiff : public QObject {
+    Q_OBJECT
+
+private slots:
+    void spanChangedMatchesScalar();
+    void spanChangedRandom();
+    void changedRegionsOddWidth();
+};
+
+void TestStepDiff::spanChangedMatchesScalar()
+{
+    // Длины не кратные 16 - векторная часть плюс хвост; сдвиг - невыровненные адреса
+    const int MaxBytes = 70;
+    const QList<int> thresholds = {0, 1, 39, 40, 254, 255};
+
+    quint32 state = 1;
+    QByteArray base(MaxBytes + 4, Qt::Uninitialized);
+    for (int i = 0; i < base.size(); ++i) {
+        base[i] = char(nextRandom(state));
+    }
+
+    for (int shift = 0; shift < 4; ++shift) {
+        for (int bytes = 0; bytes <= MaxBytes; ++bytes) {
+            for (int threshold : thresholds) {
+                const uchar limit = uchar(threshold);
+                const uchar *a = reinterpret_cast<const uchar *>(base.constData()) + shift;
+                QByteArray other = base;
+                uchar *b = reinterpret_cast<uchar *>(other.data()) + shift;
+
+                QCOMPARE(StepDiff::spanChanged(a, b, bytes, limit), false);
+
+                // Один отличающийся байт на каждой позиции: ровно на пороге и на единицу больше
+                for (int position = 0; position < bytes; ++position) {
+                    for (int delta : {threshold, threshold + 1, -threshold, -threshold - 1}) {
+                        b[position] = uchar(qBound(0, int(a[position]) + delta, 255));
+                        QCOMPARE(StepDiff::spanChanged(a, b, bytes, limit),
+                                 scalarSpanChanged(a, b, bytes, limit));
+                        b[position] = a[position];
+                    }
+                }
+            }
+        }
+    }
+}
+
+void TestStepDiff::spanChangedRandom()
+{
+    // Много мелких отличий около порога, как шум сжатия
+    quint32 state = 7;
+    QByteArray a(4099, Qt::Uninitialized);
+    QByteArray b(4099, Qt::Uninitialized);
+
+    for (int round = 0; round < 2000; ++round) {
+        const int bytes = int(nextRandom(state) % 4096) + 1;
+        const int shift = int(nextRandom(state) % 3);
+        const uchar limit = uchar(nextRandom(state) % 64);
+        const int noise = int(limit) + 1;
+
+        for (int i = 0; i < bytes + shift; ++i) {
+            const int value = int(nextRandom(state) & 0xFF);
+            const int delta = int(nextRandom(state) % (2 * noise + 1)) - noise;
+            a[i] = char(value);
+            b[i] = char(qBound(0, value + delta, 255));
+        }
+
+        const uchar *pa = reinterpret_cast<const uchar *>(a.constData()) + shift;
+        const uchar *pb = reinterpret_cast<const uchar *>(b.constData()) + shift;
+        QCOMPARE(StepDiff::spanChanged(pa, pb, bytes, limit), scalarSpanChanged(pa, pb, bytes, limit));
+    }
+}
+
+void TestStepDiff::changedRegionsOddWidth()
+{
+    QImage previous(101, 37, QImage::Format_RGB32);
+    previous.fill(Qt::white);
+    QImage current = previous;
+
+    QVERIFY(StepDiff::changedRegions(previous, current).isEmpty());
+
+    // Изменен только последний столбец - он попадает в хвост строки
+    current.setPixel(100, 20, qRgb(0, 0, 0));
+    const QVector<QRect> regions = StepDiff::changedRegions(previous, current);
+    QCOMPARE(regions.size(), 1);
+    QVERIFY(regions.first().contains(QPoint(100, 20)));
+    QVERIFY(current.rect().contains(regions.first()));
+
+    // Разность ниже порога не подсвечивается
+    QImage noisy = previous;
+    noisy.setPixel(50, 10, qRgb(255 - StepDiff::DefaultThreshold, 255, 255));
+    QVERIFY(StepDiff::changedRegions(previous, noisy).isEmpty());
+}
+
+QTEST_GUILESS_MAIN(TestStepDiff)
+
+#include "tst_stepdiff.moc"
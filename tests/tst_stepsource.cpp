@@ -0,0 +1,563 @@
+#include "stepsource.h"
+
+#include <QFile>
+#include <QTemporaryDir>
+#include <QtEndian>
+#include <QtTest>
+
+#include <cstring>
+
+#ifdef FLIPBOOK_QT_ZLIB
+#include <QtZlib/zlib.h>
+#else
+#include <zlib.h>
+#endif
+
+// Архивы-фикстуры собираются в самом тесте: так видно, какие байты проверяются,
+// и битые варианты получаются правкой нескольких байт готового архива
+namespace {
+
+void appendU16(QByteArray &out, quint16 value)
+{
+    uchar bytes[2];
+    qToLittleEndian(value, bytes);
+    out.append(reinterpret_cast<const char *>(bytes), 2);
+}
+
+void appendU32(QByteArray &out, quint32 value)
+{
+    uchar bytes[4];
+    qToLittleEndian(value, bytes);
+    out.append(reinterpret_cast<const char *>(bytes), 4);
+}
+
+void appendU64(QByteArray &out, quint64 value)
+{
+    uchar bytes[8];
+    qToLittleEndian(value, bytes);
+    out.append(reinterpret_cast<const char *>(bytes), 8);
+}
+
+void putU32(QByteArray &out, int offset, quint32 value)
+{
+    qToLittleEndian(value, reinterpret_cast<uchar *>(out.data() + offset));
+}
+
+// Сырой deflate без заголовка zlib, как в ZIP
+QByteArray deflateRaw(const QByteArray &data)
+{
+    z_stream stream = {};
+    if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return QByteArray();
+    }
+    QByteArray out(int(deflateBound(&stream, uLong(data.size()))), Qt::Uninitialized);
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.constData()));
+    stream.avail_in = uInt(data.size());
+    stream.next_out = reinterpret_cast<Bytef *>(out.data());
+    stream.avail_out = uInt(out.size());
+    const int result = deflate(&stream, Z_FINISH);
+    out.resize(int(stream.total_out));
+    deflateEnd(&stream);
+    return result == Z_STREAM_END ? out : QByteArray();
+}
+
+// Данные, которые сжимаются, но не в один блок: сжатое больше порции чтения
+QByteArray sampleData(int size, quint32 seed)
+{
+    QByteArray data(size, Qt::Uninitialized);
+    quint32 state = seed;
+    for (int i = 0; i < size; ++i) {
+        state = state * 1103515245u + 12345u;
+        data[i] = (i % 3 == 0) ? char('a' + i % 26) : char(state >> 24);
+    }
+    return data;
+}
+
+struct ZipEntry {
+    QByteArray name;
+    QByteArray data;
+    quint16 method = 0;         // 0 - store, 8 - deflate, другое пишется как store
+    quint16 flags = 0x0800;     // Имя в UTF-8
+    bool zip64 = false;         // Размеры и смещение - в дополнительном поле ZIP64
+};
+
+QByteArray buildZip(const QList<ZipEntry> &entries, bool zip64Directory = false)
+{
+    QByteArray archive;
+    QByteArray directory;
+
+    for (const ZipEntry &entry : entries) {
+        const QByteArray stored = entry.method == 8 ? deflateRaw(entry.data) : entry.data;
+        const quint32 crc = quint32(crc32(0, reinterpret_cast<const Bytef *>(entry.data.constData()),
+                                          uInt(entry.data.size())));
+        const quint32 offset = quint32(archive.size());
+
+        // Локальный заголовок - с дополнительным полем другой длины, чем в каталоге
+        appendU32(archive, 0x04034b50);
+        appendU16(archive, 20);
+        appendU16(archive, entry.flags);
+        appendU16(archive, entry.method);
+        appendU32(archive, 0);
+        appendU32(archive, crc);
+        appendU32(archive, quint32(stored.size()));
+        appendU32(archive, quint32(entry.data.size()));
+        appendU16(archive, quint16(entry.name.size()));
+        appendU16(archive, 4);
+        archive += entry.name;
+        appendU16(archive, 0xCAFE);
+        appendU16(archive, 0);
+        archive += stored;
+
+        QByteArray extra;
+        if (entry.zip64) {
+            appendU16(extra, 0x0001);
+            appendU16(extra, 24);
+            appendU64(extra, quint64(entry.data.size()));
+            appendU64(extra, quint64(stored.size()));
+            appendU64(extra, offset);
+        }
+
+        appendU32(directory, 0x02014b50);
+        appendU16(directory, 45);
+        appendU16(directory, 45);
+        appendU16(directory, entry.flags);
+        appendU16(directory, entry.method);
+        appendU32(directory, 0);
+        appendU32(directory, crc);
+        appendU32(directory, entry.zip64 ? 0xFFFFFFFF : quint32(stored.size()));
+        appendU32(directory, entry.zip64 ? 0xFFFFFFFF : quint32(entry.data.size()));
+        appendU16(directory, quint16(entry.name.size()));
+        appendU16(directory, quint16(extra.size()));
+        appendU16(directory, 0);
+        appendU16(directory, 0);
+        appendU16(directory, 0);
+        appendU32(directory, 0);
+        appendU32(directory, entry.zip64 ? 0xFFFFFFFF : offset);
+        directory += entry.name;
+        directory += extra;
+    }
+
+    const quint64 directoryOffset = quint64(archive.size());
+    archive += directory;
+
+    if (zip64Directory) {
+        const quint64 recordOffset = quint64(archive.size());
+        appendU32(archive, 0x06064b50);
+        appendU64(archive, 44);
+        appendU16(archive, 45);
+        appendU16(archive, 45);
+        appendU32(archive, 0);
+        appendU32(archive, 0);
+        appendU64(archive, quint64(entries.size()));
+        appendU64(archive, quint64(entries.size()));
+        appendU64(archive, quint64(directory.size()));
+        appendU64(archive, directoryOffset);
+
+        appendU32(archive, 0x07064b50);
+        appendU32(archive, 0);
+        appendU64(archive, recordOffset);
+        appendU32(archive, 1);
+    }
+
+    appendU32(archive, 0x06054b50);
+    appendU16(archive, 0);
+    appendU16(archive, 0);
+    appendU16(archive, zip64Directory ? 0xFFFF : quint16(entries.size()));
+    appendU16(archive, zip64Directory ? 0xFFFF : quint16(entries.size()));
+    appendU32(archive, quint32(directory.size()));
+    appendU32(archive, zip64Directory ? 0xFFFFFFFF : quint32(directoryOffset));
+    appendU16(archive, 0);
+    return archive;
+}
+
+QByteArray tarHeader(const QByteArray &name, qint64 size, char type, const QByteArray &prefix = QByteArray())
+{
+    QByteArray block(512, '\0');
+    std::memcpy(block.data(), name.constData(), size_t(qMin(name.size(), 100)));
+    std::memcpy(block.data() + 100, "0000644", 7);
+    std::memcpy(block.data() + 108, "0000000", 7);
+    std::memcpy(block.data() + 116, "0000000", 7);
+    const QByteArray octalSize = QByteArray::number(size, 8).rightJustified(11, '0');
+    std::memcpy(block.data() + 124, octalSize.constData(), 11);
+    std::memcpy(block.data() + 136, "00000000000", 11);
+    block[156] = type;
+    std::memcpy(block.data() + 257, "ustar", 6);
+    std::memcpy(block.data() + 263, "00", 2);
+    std::memcpy(block.data() + 345, prefix.constData(), size_t(qMin(prefix.size(), 155)));
+
+    int sum = 0;
+    std::memset(block.data() + 148, ' ', 8);
+    for (char c : block) {
+        sum += uchar(c);
+    }
+    const QByteArray checksum = QByteArray::number(sum, 8).rightJustified(6, '0');
+    std::memcpy(block.data() + 148, checksum.constData(), 6);
+    block[154] = '\0';
+    return block;
+}
+
+void appendTarMember(QByteArray &archive, const QByteArray &name, const QByteArray &data,
+                     char type = '0', const QByteArray &prefix = QByteArray())
+{
+    archive += tarHeader(name, data.size(), type, prefix);
+    archive += data;
+    archive += QByteArray(int((512 - data.size() % 512) % 512), '\0');
+}
+
+// Запись pax "<длина> path=<путь>\n": длина включает саму себя
+QByteArray paxRecord(const QByteArray &key, const QByteArray &value)
+{
+    const QByteArray body = ' ' + key + '=' + value + '\n';
+    int length = body.size() + 1;
+    while (QByteArray::number(length).size() + body.size() != length) {
+        ++length;
+    }
+    return QByteArray::number(length) + body;
+}
+
+QByteArray finishTar(QByteArray archive)
+{
+    return archive + QByteArray(1024, '\0');
+}
+
+// Читает устройство мелкими порциями, как читатель заголовка изображения
+QByteArray readInPieces(QIODevice *device, int piece)
+{
+    QByteArray result;
+    while (true) {
+        const QByteArray chunk = device->read(piece);
+        if (chunk.isEmpty()) break;
+        result += chunk;
+    }
+    return result;
+}
+
+}
+
+class TestStepSource : public QObject {
+    Q_OBJECT
+
+private slots:
+    void init();
+
+    void zipStoredAndDeflated();
+    void zipDeviceSeeks();
+    void zipZip64();
+    void zipSkipsUnsupportedEntries();
+    void zipTruncated();
+    void zipBrokenCentralDirectory();
+    void zipBrokenExtraField();
+    void zipBrokenLocalHeader();
+    void zipTruncatedDeflateData();
+
+    void tarUstar();
+    void tarGnuLongName();
+    void tarPaxPath();
+    void tarBrokenChecksum();
+    void tarTruncated();
+
+private:
+    // Каждый архив - отдельный файл: реестр источников кэширует их по пути
+    QString writeArchive(const QByteArray &data, const QString &suffix);
+
+    QTemporaryDir m_dir;
+    int m_archiveCount = 0;
+};
+
+void TestStepSource::init()
+{
+    QVERIFY(m_dir.isValid());
+}
+
+QString TestStepSource::writeArchive(const QByteArray &data, const QString &suffix)
+{
+    const QString path = m_dir.filePath(QString("archive%1.%2").arg(++m_archiveCount).arg(suffix));
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly) || file.write(data) != data.size()) {
+        return QString();
+    }
+    return path;
+}
+
+void TestStepSource::zipStoredAndDeflated()
+{
+    ZipEntry stored;
+    stored.name = "steps/01.txt";
+    stored.data = "Первый шаг";
+
+    ZipEntry deflated;
+    deflated.name = "steps/02.bin";
+    deflated.data = sampleData(300 * 1024, 1);
+    deflated.method = 8;
+
+    ZipEntry empty;
+    empty.name = "steps/03.txt";
+    empty.method = 8;
+
+    ZipEntry directory;
+    directory.name = "steps/";
+
+    const QString path = writeArchive(buildZip({directory, stored, deflated, empty}), "zip");
+    std::shared_ptr<StepSource> source = StepSource::archive(path);
+    QVERIFY(source != nullptr);
+    QCOMPARE(source->members(), QStringList({"steps/01.txt", "steps/02.bin", "steps/03.txt"}));
+    QCOMPARE(source->memberSize("steps/02.bin"), qint64(deflated.data.size()));
+
+    QCOMPARE(StepSource::readFile(StepSource::memberPath(path, "steps/01.txt")), stored.data);
+    QCOMPARE(StepSource::readFile(StepSource::memberPath(path, "steps/02.bin")), deflated.data);
+    QCOMPARE(StepSource::readFile(StepSource::memberPath(path, "steps/03.txt")), QByteArray());
+
+    std::unique_ptr<QIODevice> device = StepSource::openFile(StepSource::memberPath(path, "steps/02.bin"));
+    QVERIFY(device != nullptr);
+    QCOMPARE(device->size(), qint64(deflated.data.size()));
+    QCOMPARE(readInPieces(device.get(), 1000), deflated.data);
+
+    const StepSource::FileStat stat = StepSource::stat(StepSource::memberPath(path, "steps/01.txt"));
+    QVERIFY(stat.exists);
+    QCOMPARE(stat.size, qint64(stored.data.size()));
+    QVERIFY(!StepSource::stat(StepSource::memberPath(path, "steps/missing.txt")).exists);
+}
+
+void TestStepSource::zipDeviceSeeks()
+{
+    ZipEntry stored;
+    stored.name = "stored.bin";
+    stored.data = sampleData(100 * 1024 + 7, 2);
+
+    ZipEntry deflated;
+    deflated.name = "deflated.bin";
+    deflated.data = sampleData(200 * 1024 + 13, 3);
+    deflated.method = 8;
+
+    const QString path = writeArchive(buildZip({stored, deflated}), "zip");
+    for (const ZipEntry &entry : {stored, deflated}) {
+        std::unique_ptr<QIODevice> device = StepSource::openFile(StepSource::memberPath(path, entry.name));
+        QVERIFY(device != nullptr);
+
+        // Заголовок, затем переход вперед, назад и чтение хвоста через конец
+        QCOMPARE(device->read(16), entry.data.left(16));
+        QVERIFY(device->seek(150 * 1024 % entry.data.size()));
+        QCOMPARE(device->read(4096), entry.data.mid(150 * 1024 % entry.data.size(), 4096));
+        QVERIFY(device->seek(3));
+        QCOMPARE(device->read(5), entry.data.mid(3, 5));
+        QVERIFY(device->seek(entry.data.size() - 5));
+        QCOMPARE(device->read(100), entry.data.right(5));
+        QVERIFY(device->atEnd());
+    }
+}
+
+void TestStepSource::zipZip64()
+{
+    ZipEntry stored;
+    stored.name = "big/01.txt";
+    stored.data = "stored via zip64";
+    stored.zip64 = true;
+
+    ZipEntry deflated;
+    deflated.name = "big/02.bin";
+    deflated.data = sampleData(70 * 1024, 4);
+    deflated.method = 8;
+    deflated.zip64 = true;
+
+    const QString path = writeArchive(buildZip({stored, deflated}, true), "zip");
+    std::shared_ptr<StepSource> source = StepSource::archive(path);
+    QVERIFY(source != nullptr);
+    QCOMPARE(source->members(), QStringList({"big/01.txt", "big/02.bin"}));
+    QCOMPARE(source->memberSize("big/02.bin"), qint64(deflated.data.size()));
+    QCOMPARE(source->read("big/01.txt"), stored.data);
+    QCOMPARE(source->read("big/02.bin"), deflated.data);
+}
+
+void TestStepSource::zipSkipsUnsupportedEntries()
+{
+    ZipEntry plain;
+    plain.name = "plain.txt";
+    plain.data = "ok";
+
+    ZipEntry encrypted;
+    encrypted.name = "secret.txt";
+    encrypted.data = "not really encrypted";
+    encrypted.flags |= 0x0001;
+
+    ZipEntry bzip2;
+    bzip2.name = "bzip2.txt";
+    bzip2.data = "unsupported method";
+    bzip2.method = 12;
+
+    const QString path = writeArchive(buildZip({encrypted, plain, bzip2}), "zip");
+    std::shared_ptr<StepSource> source = StepSource::archive(path);
+    QVERIFY(source != nullptr);
+    QCOMPARE(source->members(), QStringList({"plain.txt"}));
+    QVERIFY(!StepSource::openFile(StepSource::memberPath(path, "secret.txt")));
+}
+
+void TestStepSource::zipTruncated()
+{
+    ZipEntry entry;
+    entry.name = "a.txt";
+    entry.data = "data";
+    const QByteArray archive = buildZip({entry});
+
+    // Без записи конца каталога архив не открывается
+    QVERIFY(!StepSource::archive(writeArchive(archive.left(archive.size() - 22), "zip")));
+    QVERIFY(!StepSource::archive(writeArchive(QByteArray(10, 'x'), "zip")));
+    QVERIFY(!StepSource::archive(writeArchive(QByteArray(), "zip")));
+}
+
+void TestStepSource::zipBrokenCentralDirectory()
+{
+    ZipEntry entry;
+    entry.name = "a.txt";
+    entry.data = "data";
+    QByteArray archive = buildZip({entry});
+
+    // Сигнатура записи каталога
+    const int directory = archive.lastIndexOf("PK\x01\x02");
+    QVERIFY(directory > 0);
+    archive[directory + 2] = 'X';
+    QVERIFY(!StepSource::archive(writeArchive(archive, "zip")));
+
+    // Каталог за концом файла
+    archive = buildZip({entry});
+    putU32(archive, archive.size() - 22 + 16, quint32(archive.size() + 100));
+    QVERIFY(!StepSource::archive(writeArchive(archive, "zip")));
+}
+
+void TestStepSource::zipBrokenExtraField()
+{
+    ZipEntry entry;
+    entry.name = "a.txt";
+    entry.data = "data";
+    entry.zip64 = true;
+    QByteArray archive = buildZip({entry});
+
+    // Длина поля ZIP64 больше, чем все дополнительные поля записи
+    const int directory = archive.lastIndexOf("PK\x01\x02");
+    const int extra = directory + 46 + entry.name.size();
+    archive[extra + 2] = char(200);
+    QVERIFY(!StepSource::archive(writeArchive(archive, "zip")));
+}
+
+void TestStepSource::zipBrokenLocalHeader()
+{
+    ZipEntry entry;
+    entry.name = "a.txt";
+    entry.data = "data";
+    QByteArray archive = buildZip({entry});
+    archive[0] = 'X';
+
+    // Каталог цел - член есть в индексе, но прочитать его нельзя
+    const QString path = writeArchive(archive, "zip");
+    std::shared_ptr<StepSource> source = StepSource::archive(path);
+    QVERIFY(source != nullptr);
+    QVERIFY(source->contains("a.txt"));
+    QCOMPARE(StepSource::readFile(StepSource::memberPath(path, "a.txt")), QByteArray());
+    QVERIFY(!StepSource::openFile(StepSource::memberPath(path, "a.txt")));
+}
+
+void TestStepSource::zipTruncatedDeflateData()
+{
+    ZipEntry entry;
+    entry.name = "a.bin";
+    entry.data = sampleData(150 * 1024, 5);
+    entry.method = 8;
+    QByteArray archive = buildZip({entry});
+
+    // Сжатый размер в каталоге вдвое меньше настоящего - поток обрывается
+    const int directory = archive.lastIndexOf("PK\x01\x02");
+    const quint32 compressedSize = qFromLittleEndian<quint32>(reinterpret_cast<const uchar *>(archive.constData() + directory + 20));
+    putU32(archive, directory + 20, compressedSize / 2);
+
+    const QString path = writeArchive(archive, "zip");
+    QCOMPARE(StepSource::readFile(StepSource::memberPath(path, "a.bin")), QByteArray());
+
+    std::unique_ptr<QIODevice> device = StepSource::openFile(StepSource::memberPath(path, "a.bin"));
+    QVERIFY(device != nullptr);
+    QVERIFY(device->seek(entry.data.size() - 10));
+    QCOMPARE(device->read(10), QByteArray());
+}
+
+void TestStepSource::tarUstar()
+{
+    const QByteArray first = "first step";
+    const QByteArray second = sampleData(1500, 6);
+
+    QByteArray archive;
+    appendTarMember(archive, "./steps/", QByteArray(), '5');
+    appendTarMember(archive, "./steps/01.txt", first);
+    appendTarMember(archive, "02.bin", second, '0', "deep/prefix");
+    appendTarMember(archive, "link.txt", QByteArray(), '2');
+
+    const QString path = writeArchive(finishTar(archive), "tar");
+    std::shared_ptr<StepSource> source = StepSource::archive(path);
+    QVERIFY(source != nullptr);
+    QCOMPARE(source->members(), QStringList({"steps/01.txt", "deep/prefix/02.bin"}));
+    QCOMPARE(source->read("steps/01.txt"), first);
+
+    std::unique_ptr<QIODevice> device = StepSource::openFile(StepSource::memberPath(path, "deep/prefix/02.bin"));
+    QVERIFY(device != nullptr);
+    QCOMPARE(readInPieces(device.get(), 100), second);
+}
+
+void TestStepSource::tarGnuLongName()
+{
+    const QByteArray longName = "steps/" + QByteArray(150, 'n') + ".txt";
+    const QByteArray data = "long name";
+
+    QByteArray archive;
+    appendTarMember(archive, "././@LongLink", longName + '\0', 'L');
+    appendTarMember(archive, longName.left(99), data);
+    appendTarMember(archive, "short.txt", "short");
+
+    const QString path = writeArchive(finishTar(archive), "tar");
+    std::shared_ptr<StepSource> source = StepSource::archive(path);
+    QVERIFY(source != nullptr);
+    QCOMPARE(source->members(), QStringList({QString::fromLatin1(longName), "short.txt"}));
+    QCOMPARE(source->read(QString::fromLatin1(longName)), data);
+    QCOMPARE(source->read("short.txt"), QByteArray("short"));
+}
+
+void TestStepSource::tarPaxPath()
+{
+    const QString longName = "шаги/" + QString(120, QChar(0x0448)) + ".txt";
+    const QByteArray data = "pax path";
+
+    QByteArray archive;
+    appendTarMember(archive, "PaxHeaders/x", paxRecord("mtime", "1700000000.5")
+                                               + paxRecord("path", longName.toUtf8()), 'x');
+    appendTarMember(archive, "truncated-name.txt", data);
+    appendTarMember(archive, "next.txt", "next");
+
+    const QString path = writeArchive(finishTar(archive), "tar");
+    std::shared_ptr<StepSource> source = StepSource::archive(path);
+    QVERIFY(source != nullptr);
+    QCOMPARE(source->members(), QStringList({longName, "next.txt"}));
+    QCOMPARE(source->read(longName), data);
+}
+
+void TestStepSource::tarBrokenChecksum()
+{
+    QByteArray archive;
+    appendTarMember(archive, "a.txt", "data");
+    archive[0] = 'b';
+    QVERIFY(!StepSource::archive(writeArchive(finishTar(archive), "tar")));
+}
+
+void TestStepSource::tarTruncated()
+{
+    QByteArray archive;
+    appendTarMember(archive, "a.txt", "data");
+    appendTarMember(archive, "b.bin", sampleData(4096, 7));
+
+    // Обрыв посреди заголовка: дальше заголовков нет, индекс - то, что успели прочитать
+    std::shared_ptr<StepSource> source = StepSource::archive(writeArchive(archive.left(1024 + 100), "tar"));
+    QVERIFY(source != nullptr);
+    QCOMPARE(source->members(), QStringList({"a.txt"}));
+
+    // Обрыв посреди данных: размер члена больше файла
+    QVERIFY(!StepSource::archive(writeArchive(archive.left(1024 + 512 + 100), "tar")));
+}
+
+QTEST_GUILESS_MAIN(TestStepSource)
+
+#include "tst_stepsource.moc"